@@ -0,0 +1,64 @@
+/**********************************************************************
+ *
+ * Helpers shared by the benchmark drivers in bench/
+ * A clock, a way to call a builtin the way the evaluator does, and a
+ * loop timing repeated calls of a builtin
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+#include "../include/repl.h"
+
+
+/* Seconds on a monotonic clock */
+static inline double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+/* Call a builtin with the given arguments, taking them */
+static inline lval* call(lenv* e, lbuiltin f, int n, lval** args) {
+    lval* a = lval_sexpr();
+    lval_reserve(a, n);
+    for (int i = 0; i < n; i++) { a = lval_add(a, args[i]); }
+    return f(e, a);
+}
+
+
+/**
+ * Call a builtin "runs" times on copies of the given arguments and
+ * print the average time under "name", returning the last result
+ * The caller prints whatever it wants to show of it on the same line
+ */
+static inline lval* run(lenv* e, char* name, int runs,
+                        lbuiltin f, int n, lval** args) {
+    lval* x = NULL;
+    double start = now();
+
+    for (int i = 0; i < runs; i++) {
+        if (x) { lval_del(x); }
+
+        lval* a = lval_sexpr();
+        lval_reserve(a, n);
+        for (int j = 0; j < n; j++) { a = lval_add(a, lval_copy(args[j])); }
+        x = f(e, a);
+    }
+
+    double ms = (now() - start) * 1e3 / runs;
+    printf("%-20s %9.3f ms   ", name, ms);
+    return x;
+}
+
+
+#endif
@@ -0,0 +1,90 @@
+/**********************************************************************
+ *
+ * Benchmark for arbitrary precision integers
+ * Computes factorial(1000) with the "*" builtin and fib(10000) with
+ * "+" the way a lispy loop would, one call per step, and reports the
+ * average time of each along with the number of digits of the result
+ * Run it with "make bench"
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "bench.h"
+
+
+#define RUNS 20
+
+
+/* Call a builtin with two arguments, taking both */
+static lval* call2(lenv* e, lbuiltin f, lval* x, lval* y) {
+    return call(e, f, 2, (lval*[]) { x, y });
+}
+
+
+static lval* factorial(lenv* e, int n) {
+    lval* x = lval_num(1);
+    for (int i = 2; i <= n; i++) { x = call2(e, builtin_mul, x, lval_num(i)); }
+    return x;
+}
+
+
+static lval* fib(lenv* e, int n) {
+    lval* a = lval_num(0);
+    lval* b = lval_num(1);
+
+    for (int i = 0; i < n; i++) {
+        lval* c = call2(e, builtin_add, lval_copy(a), lval_copy(b));
+        lval_del(a);
+        a = b;
+        b = c;
+    }
+
+    lval_del(b);
+    return a;
+}
+
+
+/* Decimal digits of a number, by comparing against powers of ten */
+static int digits(lenv* e, lval* x) {
+    int d = 1;
+    lval* p = lval_num(10);
+
+    while (lval_big_cmp(p, x) <= 0) {
+        p = call2(e, builtin_mul, p, lval_num(10));
+        d++;
+    }
+
+    lval_del(p);
+    return d;
+}
+
+
+/* Time a whole loop of calls rather than a single builtin */
+static void run_loop(lenv* e, char* name, lval* (*f)(lenv*, int), int n) {
+    lval* x = NULL;
+    double start = now();
+
+    for (int i = 0; i < RUNS; i++) {
+        if (x) { lval_del(x); }
+        x = f(e, n);
+    }
+
+    double ms = (now() - start) * 1e3 / RUNS;
+    printf("%-16s %9.3f ms   (%d digits)\n", name, ms, digits(e, x));
+    lval_del(x);
+}
+
+
+int main(int argc, char** argv) {
+    lenv* e = lenv_new();
+    lenv_add_builtins(e);
+
+    run_loop(e, "factorial(1000)", factorial, 1000);
+    run_loop(e, "fib(10000)", fib, 10000);
+
+    lenv_del(e);
+    return 0;
+}
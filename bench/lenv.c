@@ -0,0 +1,67 @@
+/**********************************************************************
+ *
+ * Benchmark for environment lookups
+ * Grows a global environment the way a big program would, with all
+ * the builtins followed by thousands of definitions, and reports the
+ * average cost of looking up a defined symbol at each size
+ * Run it with "make bench"
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "bench.h"
+
+
+#define LOOKUPS 2000000
+
+
+int main(int argc, char** argv) {
+
+    int sizes[] = { 10, 100, 1000, 10000 };
+    int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    lenv* e = lenv_new();
+    lenv_add_builtins(e);
+
+    /* Every symbol ever defined, looked up round robin */
+    lval** syms = malloc(sizeof(lval*) * sizes[nsizes-1]);
+    int defined = 0;
+
+    puts("definitions   ns/lookup");
+
+    for (int s = 0; s < nsizes; s++) {
+
+        /* Grow the environment up to the next size */
+        for (; defined < sizes[s]; defined++) {
+            char name[32];
+            snprintf(name, sizeof(name), "var-%d", defined);
+
+            syms[defined] = lval_sym(name);
+            lval* v = lval_num(defined);
+            lenv_def(e, syms[defined], v);
+            lval_del(v);
+        }
+
+        /* Time lookups spread over all defined symbols */
+        long check = 0;
+        double start = now();
+
+        for (int i = 0; i < LOOKUPS; i++) {
+            lval* x = lenv_get(e, syms[(i * 7919L) % defined]);
+            check += lval_to_num(x);
+            lval_del(x);
+        }
+
+        double ns = (now() - start) * 1e9 / LOOKUPS;
+        printf("%11d   %9.1f   (checksum %ld)\n", defined, ns, check);
+    }
+
+    for (int i = 0; i < defined; i++) { lval_del(syms[i]); }
+    free(syms);
+    lenv_del(e);
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+/**********************************************************************
+ *
+ * Benchmark for the list library
+ * Times "last", "sum", "map" and "foldl" over a list of a million
+ * numbers, calling the builtins the way the evaluator would
+ * Run it with "make bench"
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "bench.h"
+
+
+#define ELEMENTS 1000000
+#define RUNS 20
+
+
+/* Time a list builtin and show its result, or the first cell of a list */
+static void run_list(lenv* e, char* name, lbuiltin f, int n, lval** args) {
+    lval* x = run(e, name, RUNS, f, n, args);
+    putchar('(');
+    lval_print(lval_type(x) == LVAL_QEXPR ? x->cell[0] : x);
+    puts(")");
+    lval_del(x);
+}
+
+
+int main(int argc, char** argv) {
+    lenv* e = lenv_new();
+    lenv_add_builtins(e);
+
+    lval* list = lval_qexpr();
+    for (int i = 0; i < ELEMENTS; i++) { list = lval_add(list, lval_num(i % 1000)); }
+
+    lval* add = lval_fun(builtin_add);
+    lval* sub = lval_fun(builtin_sub);
+    lval* zero = lval_num(0);
+
+    lval* last[] = { list };
+    lval* map[] = { sub, list };
+    lval* foldl[] = { add, zero, list };
+
+    run_list(e, "last", builtin_last, 1, last);
+    run_list(e, "sum", builtin_sum, 1, last);
+    run_list(e, "map -", builtin_map, 2, map);
+    run_list(e, "foldl + 0", builtin_foldl, 3, foldl);
+
+    lval_del(list);
+    lval_del(add);
+    lval_del(sub);
+    lenv_del(e);
+    return 0;
+}
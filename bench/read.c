@@ -0,0 +1,96 @@
+/**********************************************************************
+ *
+ * Benchmark for the reader
+ * Reads a data file of a few thousand rows that repeat the same small
+ * lists, with and without hash consing (--hash-cons), and checks that
+ * a list read only once comes out unshared, so that it is still
+ * changed in place instead of being copied first
+ * Run it with "make bench"
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "bench.h"
+
+
+#define ROWS 20000
+#define RUNS 10
+
+
+static mpc_ast_t* num(long n) {
+    char contents[32];
+    snprintf(contents, sizeof(contents), "%ld", n);
+    return mpc_ast_new("expr|number|regex", contents);
+}
+
+
+/* A Q-Expression holding the numbers from "start" up to, but not including, "end" */
+static mpc_ast_t* range(long start, long end) {
+    mpc_ast_t* t = mpc_ast_new("expr|qexpr|>", "");
+    for (long i = start; i < end; i++) { mpc_ast_add_child(t, num(i)); }
+    return t;
+}
+
+
+/* What the parser makes of rows like {7 {1 2 3} {4 5 6}} */
+static mpc_ast_t* rows(void) {
+    mpc_ast_t* t = mpc_ast_new(">", "");
+
+    for (long i = 0; i < ROWS; i++) {
+        mpc_ast_t* row = mpc_ast_new("expr|qexpr|>", "");
+        mpc_ast_add_child(row, num(i));
+        mpc_ast_add_child(row, range(1, 4));
+        mpc_ast_add_child(row, range(4, 7));
+        mpc_ast_add_child(t, row);
+    }
+
+    return t;
+}
+
+
+static void time_read(char* name, mpc_ast_t* t) {
+    double start = now();
+
+    for (int i = 0; i < RUNS; i++) { lval_del(lval_read(t)); }
+
+    double ms = (now() - start) * 1e3 / RUNS;
+    printf("%-20s %9.3f ms   (%d rows)\n", name, ms, ROWS);
+}
+
+
+int main(int argc, char** argv) {
+    lenv* e = lenv_new();
+    lenv_add_builtins(e);
+
+    mpc_ast_t* t = rows();
+    time_read("read", t);
+
+    lread_hash_cons = 1;
+    time_read("read --hash-cons", t);
+    mpc_ast_delete(t);
+
+    /* A list read once belongs to us alone, joining onto it reuses it.
+       It is popped the way load does, which hands over the reference */
+    t = mpc_ast_add_child(mpc_ast_new(">", ""), range(0, 20));
+    lval* r = lval_read(t);
+    lval* l = lval_pop(r, 0);
+    lval_del(r);
+    mpc_ast_delete(t);
+
+    lval* first = l;
+    int refs = l->refs;
+    lval* x = call(e, builtin_join, 2, (lval*[]) { l, lval_add(lval_qexpr(), lval_num(20)) });
+
+    if (refs != 1 || x != first) {
+        printf("hash consed list shared after reading (%d references)\n", refs);
+        return 1;
+    }
+    puts("hash consed list read once is joined in place");
+
+    lval_del(x);
+    lenv_del(e);
+    return 0;
+}
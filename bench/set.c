@@ -0,0 +1,60 @@
+/**********************************************************************
+ *
+ * Benchmark for hash sets
+ * Builds a set out of a list of a million numbers with half of them
+ * repeated, then times the union, intersection and difference of two
+ * sets of a million elements that overlap by half
+ * Run it with "make bench"
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "bench.h"
+
+
+#define ELEMENTS 1000000
+#define RUNS 5
+
+
+/* Time a set builtin and show the size of the set it returns */
+static void run_set(lenv* e, char* name, lbuiltin f, int n, lval** args) {
+    lval* x = run(e, name, RUNS, f, n, args);
+    printf("(%d elements)\n", x->size);
+    lval_del(x);
+}
+
+
+int main(int argc, char** argv) {
+    lenv* e = lenv_new();
+    lenv_add_builtins(e);
+
+    lval* list = lval_qexpr();
+    lval* evens = lval_qexpr();
+    lval* odds = lval_qexpr();
+
+    for (int i = 0; i < ELEMENTS; i++) {
+        list = lval_add(list, lval_num(i % (ELEMENTS / 2)));
+        evens = lval_add(evens, lval_num(2 * i));
+        odds = lval_add(odds, lval_num(i < ELEMENTS / 2 ? 2 * i : 2 * i + 1));
+    }
+
+    lval* dedup[] = { list };
+    run_set(e, "set", builtin_set, 1, dedup);
+
+    lval* x = call(e, builtin_set, 1, (lval*[]) { evens });
+    lval* y = call(e, builtin_set, 1, (lval*[]) { odds });
+    lval* both[] = { x, y };
+
+    run_set(e, "set-union", builtin_set_union, 2, both);
+    run_set(e, "set-inter", builtin_set_inter, 2, both);
+    run_set(e, "set-diff", builtin_set_diff, 2, both);
+
+    lval_del(list);
+    lval_del(x);
+    lval_del(y);
+    lenv_del(e);
+    return 0;
+}
@@ -0,0 +1,54 @@
+/**********************************************************************
+ *
+ * Benchmark for packed vectors
+ * Sums a million numbers held in a vector with "vec-sum", and the same
+ * numbers held in a list with "+", then times the elementwise "*" and
+ * "vec-dot" on vectors of that size
+ * Run it with "make bench"
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "bench.h"
+
+
+#define ELEMENTS 1000000
+#define RUNS 20
+
+
+/* Show a number, or the sum of a vector */
+static void show(lenv* e, lval* x) {
+    if (lval_type(x) == LVAL_VEC) { x = call(e, builtin_vec_sum, 1, (lval*[]) { x }); }
+
+    putchar('(');
+    lval_print(x);
+    puts(")");
+    lval_del(x);
+}
+
+
+int main(int argc, char** argv) {
+    lenv* e = lenv_new();
+    lenv_add_builtins(e);
+
+    int64_t* ints = malloc(sizeof(int64_t) * ELEMENTS);
+    lval* list = lval_sexpr();
+    for (int i = 0; i < ELEMENTS; i++) {
+        ints[i] = i % 1000;
+        list = lval_add(list, lval_num(i % 1000));
+    }
+    lval* v = lval_vec(ints, ELEMENTS);
+
+    show(e, run(e, "+ over a list", RUNS, builtin_add, list->count, list->cell));
+    show(e, run(e, "vec-sum", RUNS, builtin_vec_sum, 1, (lval*[]) { v }));
+    show(e, run(e, "vec-dot", RUNS, builtin_vec_dot, 2, (lval*[]) { v, v }));
+    show(e, run(e, "* on vectors", RUNS, builtin_mul, 2, (lval*[]) { v, v }));
+
+    lval_del(list);
+    lval_del(v);
+    lenv_del(e);
+    return 0;
+}
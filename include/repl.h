@@ -31,7 +31,10 @@ void add_history(char* unused) {}
  * This headers should be the same for both
  * I have no idea if they'll work on windows
  */
+#include <limits.h>
 #include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,10 +53,11 @@ void add_history(char* unused) {}
     }
 
 #define LASSERT_TYPE(func, args, index, expect)                         \
-    LASSERT(args, args->cell[index]->type == expect,                    \
+    LASSERT(args, lval_type(args->cell[index]) == expect,               \
             "Function '%s' passed incorrect type for argument %i."      \
             "Got %s, Expected %s.",                                     \
-            func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+            func, index, ltype_name(lval_type(args->cell[index])),      \
+            ltype_name(expect))
 
 #define LASSERT_NUM(func, args, num)                                    \
     LASSERT(args, args->count == num,                                   \
@@ -82,44 +86,163 @@ void add_history(char* unused) {}
 /* Forward declarations */
 struct lval;
 struct lenv;
+struct lcode;
+struct lnode;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcode lcode;
 
 
-/* Can be Error, Number, Symbol or S-Expression */
+/**
+ * Can be Error, Number, Symbol or S-Expression
+ * LVAL_CELLS is never a value, only the "base" of a list (lval_extend)
+ */
 enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_STR,
-       LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+       LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LVAL_VEC, LVAL_MAP,
+       LVAL_SET, LVAL_CELLS, LVAL_TYPES };
 
 
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
 
-/* lval struct has a type enum, error enum or value */
-typedef struct lval {
-    int type;
+/* Bytes of a string or error, with its terminator, kept inside the node */
+#define LVAL_INLINE_CHARS 24
 
-    /* Basic */
-    long num;
-    char* err;
-    char* sym;
-    char* str;
+/* Cells of a S-Expression or Q-Expression kept inside the node */
+#define LVAL_INLINE_CELLS 4
 
-    /* Function */
-    lbuiltin builtin;
-    lenv* env;
-    lval* formals;
-    lval* body;
 
-    /* Expression */
-    int count;
-    struct lval** cell;
+/**
+ * lval struct is a type tag followed by a union of per-type payloads
+ * only the members belonging to "type" are meaningful
+ */
+typedef struct lval {
+    unsigned char type;
+
+    /* Collector flags, only used when built with LISPY_GC */
+    unsigned char mark;
+
+    /* Number of owners, the value must not be mutated while shared */
+    int refs;
+
+    union {
+        /* Number, and the limbs of a bignum (bignum.c), otherwise NULL */
+        struct {
+            long num;
+            int nlimbs;
+            uint32_t* limbs;
+        };
+
+        /* Error and String: the characters are kept in "chars" when
+           they fit, and on the heap otherwise */
+        struct {
+            union {
+                char* err;
+                char* str;
+            };
+            char chars[LVAL_INLINE_CHARS];
+        };
+
+        /* Symbol: interned name, and inside a lambda body the slot of
+           the formal it names in that lambda's frames, otherwise -1 */
+        struct {
+            char* sym;
+            int slot;
+        };
+
+        /* Function: builtin is NULL for lambdas */
+        struct {
+            lbuiltin builtin;
+            lenv* env;
+            lval* formals;
+            lval* body;
+        };
+
+        /* S-Expression and Q-Expression: "cap" cells are allocated for
+           the "count" in use. A slice views "count" cells of the list
+           "base" instead of owning its own (lval_slice), its "cap" is 0.
+           "hash" caches lval_hash, 0 until it is known */
+        struct {
+            int count;
+            int cap;
+            struct lval** cell;
+            struct lval* base;
+            uint64_t hash;
+        };
+
+        /* Vector: packed 64 bit integers (vector.c) */
+        struct {
+            int length;
+            int64_t* ints;
+        };
+
+        /* Map and Set: "size" keys in a hash trie shared between
+           versions, NULL when empty (map.c) */
+        struct {
+            int size;
+            struct lnode* root;
+        };
+    };
+
+    /* Only lists are allocated with room for these (lval_size), their
+       "cell" points here for as long as LVAL_INLINE_CELLS are enough */
+    struct lval* small[];
 
 } lval;
 
 
+/**
+ * Small integers are immediate: the value lives shifted left in the
+ * lval pointer itself with the low bit set, so it never touches the
+ * heap. Nodes are always at least 2 byte aligned so the bit is free.
+ * Numbers outside the fixnum range are boxed in a heap LVAL_NUM node.
+ */
+#define LVAL_FIXNUM_MIN (LONG_MIN >> 1)
+#define LVAL_FIXNUM_MAX (LONG_MAX >> 1)
+
+static inline int lval_is_fixnum(lval* v) {
+    return ((uintptr_t) v) & 1;
+}
+
+static inline lval* lval_fixnum(long x) {
+    return (lval*) ((((uintptr_t) x) << 1) | 1);
+}
+
+/* Type of any lval, immediate or not */
+static inline int lval_type(lval* v) {
+    return lval_is_fixnum(v) ? LVAL_NUM : v->type;
+}
+
+/* Value of a Number lval, immediate or boxed */
+static inline long lval_to_num(lval* v) {
+    return lval_is_fixnum(v) ? ((intptr_t) v) >> 1 : v->num;
+}
+
+/* Whether a Number is too large for a long, its value is then saturated */
+static inline int lval_is_big(lval* v) {
+    return !lval_is_fixnum(v) && v->type == LVAL_NUM && v->limbs;
+}
+
+
+/**
+ * Environment: a hash table of bindings, a slot is empty when its name
+ * is NULL. Lambda call frames also hold one slot per formal, in the
+ * order of "formals", so resolved references index them directly.
+ * "glob" is the global environment at the end of the chain, and the
+ * global environment points at itself.
+ * The environment of a lambda also caches its compiled body in "code".
+ */
 struct lenv {
     lenv* par;
+    lenv* glob;
+    lcode* code;
+
+    int nslots;
+    lval** slots;
+    char** names;
+
     int count;
+    int cap;
     char** syms;
     lval** vals;
 };
@@ -130,22 +253,67 @@ struct lenv {
 
 
 /**
- * Declaration of global variables
+ * Declaration of global variables (defined in readers.c)
  */
-mpc_parser_t* Number;
-mpc_parser_t* Symbol;
-mpc_parser_t* String;
-mpc_parser_t* Comment;
-mpc_parser_t* Sexpr;
-mpc_parser_t* Qexpr;
-mpc_parser_t* Expr;
-mpc_parser_t* Lispy;
+extern mpc_parser_t* Number;
+extern mpc_parser_t* Symbol;
+extern mpc_parser_t* String;
+extern mpc_parser_t* Comment;
+extern mpc_parser_t* Sexpr;
+extern mpc_parser_t* Qexpr;
+extern mpc_parser_t* Map;
+extern mpc_parser_t* Expr;
+extern mpc_parser_t* Lispy;
 
 
 
 /************************************************************************************/
 
 
+/**
+ * Node allocator (slab pool, or plain malloc with LVAL_MALLOC)
+ *
+ */
+size_t lval_size(int);
+lval* lval_alloc(int);
+void lval_free(lval*);
+void lval_finalize(lval*);
+
+
+/**
+ * Optional tracing collector (make GC=1)
+ *
+ * Values held in C locals across an evaluation must be pushed on the
+ * root stack, and stores into a value that may already be old must go
+ * through the write barrier. Each top level evaluation runs between
+ * LGC_REGION_BEGIN and LGC_REGION_END. All of them compile away
+ * without LISPY_GC.
+ */
+#ifdef LISPY_GC
+void lgc_push_root(lval*);
+void lgc_pop_roots(int);
+void lgc_write(lval*);
+void lgc_safepoint(lenv*);
+void lgc_region_begin(void);
+void lgc_region_end(lenv*);
+
+#define LGC_PUSH_ROOT(v)   lgc_push_root(v)
+#define LGC_POP_ROOTS(n)   lgc_pop_roots(n)
+#define LGC_WRITE(v)       lgc_write(v)
+#define LGC_SAFEPOINT(e)   lgc_safepoint(e)
+#define LGC_REGION_BEGIN() lgc_region_begin()
+#define LGC_REGION_END(e)  lgc_region_end(e)
+#else
+#define LGC_PUSH_ROOT(v)
+#define LGC_POP_ROOTS(n)
+#define LGC_WRITE(v)
+#define LGC_SAFEPOINT(e)
+#define LGC_REGION_BEGIN()
+#define LGC_REGION_END(e)
+#endif
+
+
+
 /**
  * Definitions of constructors
  *
@@ -159,18 +327,193 @@ lval* lval_str(char*);
 
 lval* lval_fun(lbuiltin);
 lval* lval_lambda(lval*, lval*);
+lenv* lval_bind(lval*, lval*, lval**);
 lval* lval_call(lenv*, lval*, lval*);
 
 lval* lval_copy(lval*);
+lval* lval_clone(lval*);
+lval* lval_unshare(lval*);
+lval* lval_slice(lval*, int, int);
+void lval_own_cells(lval*);
+void lval_reserve(lval*, int);
+lval* lval_extend(lval*, int);
 void lval_del(lval*);
 
 
+/* Bumped whenever a global binding changes */
+extern unsigned long lenv_stamp;
+
 lenv* lenv_new(void);
+lenv* lenv_frame(lval*);
 void lenv_del(lenv*);
 lval* lenv_get(lenv*, lval*);
 void lenv_put(lenv*, lval*, lval*);
 lenv* lenv_copy(lenv*);
 void lenv_def(lenv*, lval*, lval*);
+lenv* lenv_enter(lenv*, lenv*, lenv*);
+void lenv_leave(lenv*, lenv*);
+
+
+
+/**
+ * Symbol table
+ *
+ * Interned names are preceded by a count of the bindings of that name
+ * outside the global environment. While it is zero a lookup can skip
+ * the whole (dynamic) environment chain.
+ */
+typedef struct lsym {
+    int locals;
+    char name[];
+} lsym;
+
+#define LSYM(s) ((lsym*) ((s) - offsetof(lsym, name)))
+
+unsigned long lsym_hash(char*);
+char* lsym_intern(char*);
+
+
+
+/**
+ * Bytecode compiler and stack VM
+ *
+ * Each word of code is an opcode, or an operand of the opcode before
+ * it: a jump target, an argument count, or a constant or symbol
+ * borrowed from the compiled expression. Loads also keep the global
+ * value they found, valid while lenv_stamp is unchanged.
+ */
+enum { LOP_CONST, LOP_EMPTY, LOP_LOAD, LOP_CALL,
+       LOP_TAIL, LOP_IF, LOP_JUMP, LOP_RETURN };
+
+typedef union lword {
+    int op;
+    int arg;
+    lval* val;
+    unsigned long stamp;
+} lword;
+
+struct lcode {
+    int refs;
+    int count;
+    int cap;
+    lword* ops;
+
+    /* Stack depth while compiling, and the most the code needs */
+    int sp;
+    int depth;
+};
+
+lcode* lcode_compile(lval*);
+lcode* lcode_compile_body(lval*);
+lcode* lcode_copy(lcode*);
+void lcode_del(lcode*);
+
+/* Cleared by "--tree" to evaluate with the tree walker only */
+extern int lvm_enabled;
+
+/* Value stack shared by all running code, a root for the collector */
+extern lval** lvm_stack;
+extern int lvm_sp;
+
+/* Nested lambda calls, and the most allowed ("--max-depth=N") */
+extern int lvm_depth;
+extern int lvm_max_depth;
+
+lval* lvm_run(lenv*, lcode*, lenv*);
+lval* lvm_eval(lenv*, lval*);
+int lvm_native_room(void);
+
+
+
+/**
+ * Arbitrary precision integers
+ *
+ * Take and return Numbers of any size, with the LBOP_* arithmetic
+ * operators below. Results that fit in a long are plain numbers.
+ */
+lval* lval_big_op(int, lval*, lval*);
+int lval_big_cmp(lval*, lval*);
+lval* lval_big_read(char*);
+void lval_big_print(lval*);
+
+
+
+/**
+ * Packed vectors of 64 bit integers
+ *
+ */
+lval* lval_vec(int64_t*, int);
+lval* lval_vec_op(int, lval*);
+int lval_vec_eq(lval*, lval*);
+void lval_vec_print(lval*);
+
+lval* builtin_vec(lenv*, lval*);
+lval* builtin_vec_len(lenv*, lval*);
+lval* builtin_vec_get(lenv*, lval*);
+lval* builtin_vec_slice(lenv*, lval*);
+lval* builtin_vec_sum(lenv*, lval*);
+lval* builtin_vec_min(lenv*, lval*);
+lval* builtin_vec_max(lenv*, lval*);
+lval* builtin_vec_dot(lenv*, lval*);
+
+
+
+/**
+ * Hash maps and sets, hashing values consistently with lval_eq
+ *
+ */
+uint64_t lval_hash(lval*);
+lval* lval_map(void);
+lval* lval_map_read(lval*);
+lval* lval_map_clone(lval*);
+void lval_map_del(lval*);
+void lval_map_finalize(lval*);
+void lval_map_clear(lval*);
+void lval_map_trace(lval*, void (*)(lval*));
+int lval_map_eq(lval*, lval*);
+void lval_map_print(lval*);
+
+lval* builtin_map_get(lenv*, lval*);
+lval* builtin_map_has(lenv*, lval*);
+lval* builtin_map_put(lenv*, lval*);
+lval* builtin_map_del(lenv*, lval*);
+lval* builtin_map_keys(lenv*, lval*);
+lval* builtin_map_vals(lenv*, lval*);
+lval* builtin_map_size(lenv*, lval*);
+
+lval* lval_set(void);
+int lval_set_has(lval*, lval*);
+lval* lval_set_intern(lval*, lval*);
+void lval_set_print(lval*);
+
+lval* builtin_set(lenv*, lval*);
+lval* builtin_set_has(lenv*, lval*);
+lval* builtin_set_add(lenv*, lval*);
+lval* builtin_set_del(lenv*, lval*);
+lval* builtin_set_list(lenv*, lval*);
+lval* builtin_set_size(lenv*, lval*);
+lval* builtin_set_union(lenv*, lval*);
+lval* builtin_set_inter(lenv*, lval*);
+lval* builtin_set_diff(lenv*, lval*);
+
+
+
+/**
+ * List library, walking the cell array instead of recursing (list.c)
+ *
+ */
+lval* builtin_take(lenv*, lval*);
+lval* builtin_drop(lenv*, lval*);
+lval* builtin_split(lenv*, lval*);
+lval* builtin_len(lenv*, lval*);
+lval* builtin_nth(lenv*, lval*);
+lval* builtin_last(lenv*, lval*);
+lval* builtin_elem(lenv*, lval*);
+lval* builtin_map(lenv*, lval*);
+lval* builtin_filter(lenv*, lval*);
+lval* builtin_foldl(lenv*, lval*);
+lval* builtin_sum(lenv*, lval*);
+lval* builtin_product(lenv*, lval*);
 
 
 
@@ -178,6 +521,8 @@ void lenv_def(lenv*, lval*, lval*);
  * Readers 
  *
  */
+extern int lread_hash_cons;
+
 lval* lval_read_num(mpc_ast_t* t);
 lval* lval_read(mpc_ast_t* t);
 lval* lval_read_str(mpc_ast_t*);
@@ -191,6 +536,7 @@ lval* lval_read_str(mpc_ast_t*);
 lval* lval_add(lval* v, lval* x);
 lval* lval_eval_sexpr(lenv*, lval*);
 lval* lval_eval(lenv*, lval* v);
+lval* lval_pop(lval* v, int i);
 lval* lval_take(lval* v, int i);
 void lenv_add_builtin(lenv*, char*, lbuiltin);
 void lenv_add_builtins(lenv*);
@@ -201,16 +547,28 @@ void lenv_add_builtins(lenv*);
  *
  */
 lval* builtin(lval*, char*);
-lval* builtin_op(lenv*, lval*, char*);
+
+/**
+ * Operators shared by the builtins that fold, order, compare or define,
+ * passed to them as plain numbers so dispatch costs no string compares
+ */
+enum { LBOP_ADD, LBOP_SUB, LBOP_MUL, LBOP_DIV, LBOP_MOD, LBOP_POW,
+       LBOP_GT, LBOP_LT, LBOP_GE, LBOP_LE, LBOP_EQ, LBOP_NE,
+       LBOP_DEF, LBOP_PUT, LBOP_COUNT };
+
+extern char* lbop_names[LBOP_COUNT];
+
+lval* builtin_op(lenv*, lval*, int);
 lval* builtin_def(lenv*, lval*);
 lval* builtin_put(lenv*, lval*);
-lval* builtin_var(lenv*, lval*, char*);
+lval* builtin_var(lenv*, lval*, int);
 lval* builtin_lambda(lenv*, lval*);
 
 /* String manipulation */
 lval* builtin_load(lenv*, lval*);
 lval* builtin_error(lenv*, lval*);
 lval* builtin_print(lenv*, lval*);
+lval* builtin_max_depth(lenv*, lval*);
 
 /* List Functions */
 lval* builtin_head(lenv*, lval* a);
@@ -229,10 +587,11 @@ lval* builtin_mod(lenv*, lval*);
 lval* builtin_pow(lenv*, lval*);
 
 /* Comparisons */
-lval* builtin_ord(lenv*, lval*, char*);
+lval* builtin_ord(lenv*, lval*, int);
 int  lval_eq(lval*, lval*);
-lval* builtin_cmp(lenv*, lval*, char*);
+lval* builtin_cmp(lenv*, lval*, int);
 lval* builtin_if(lenv*, lval*);
+lval* lval_if_branch(lval*);
 
 lval* builtin_eq(lenv*, lval*);
 lval* builtin_ne(lenv*, lval*);
@@ -0,0 +1,458 @@
+/**********************************************************************
+ *
+ * Contains the arbitrary precision integers used once a Number no
+ * longer fits in a long
+ *
+ * A bignum is a boxed LVAL_NUM node that also holds its magnitude in
+ * 32 bit limbs, least significant first, with "num" saturated to
+ * LONG_MAX or LONG_MIN for its sign. Results are always normalized:
+ * whatever fits in a long becomes a plain number again, so a bignum
+ * never equals a long and every value has a single representation.
+ *
+ * The builtins fold longs with overflow checks and only come here for
+ * operands or results that do not fit (evaluaters.c)
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "../include/repl.h"
+
+
+typedef uint32_t limb;
+typedef uint64_t dlimb;
+
+#define LIMB_BITS 32
+
+/* Largest power of ten in a limb, used to read and print in chunks */
+#define LIMB_TEN        1000000000
+#define LIMB_TEN_DIGITS 9
+
+
+/* Sign and magnitude of a number being worked on */
+typedef struct lbig {
+    int neg;
+    int n;
+    limb* d;
+} lbig;
+
+
+/**
+ * View of any Number as sign and magnitude, borrowing the limbs of a
+ * bignum or filling "buf" with those of a long
+ */
+static lbig lbig_of(lval* v, limb buf[2]) {
+    lbig b;
+
+    if (lval_is_big(v)) {
+        b.neg = v->num < 0;
+        b.n = v->nlimbs;
+        b.d = v->limbs;
+        return b;
+    }
+
+    long x = lval_to_num(v);
+    unsigned long m = x < 0 ? 0UL - (unsigned long) x : (unsigned long) x;
+
+    buf[0] = (limb) m;
+    buf[1] = (limb) (m >> 16 >> 16);
+
+    b.neg = x < 0;
+    b.d = buf;
+    b.n = buf[1] ? 2 : (buf[0] ? 1 : 0);
+    return b;
+}
+
+
+static limb* lbig_alloc(int n) {
+    return calloc(n ? n : 1, sizeof(limb));
+}
+
+
+/* Number with sign "neg" and the "n" limbs of "d", which it takes over */
+static lval* lbig_value(int neg, limb* d, int n) {
+    while (n && !d[n-1]) { n--; }
+
+    /* Small enough for a long: back to a plain number */
+    if (n * LIMB_BITS <= (int) sizeof(long) * CHAR_BIT) {
+        unsigned long m = 0;
+        for (int i = n-1; i >= 0; i--) { m = (m << 16 << 16) | d[i]; }
+
+        if ((!neg || !m) && m <= (unsigned long) LONG_MAX) {
+            free(d);
+            return lval_num((long) m);
+        }
+
+        if (neg && m - 1 <= (unsigned long) LONG_MAX) {
+            free(d);
+            return lval_num(-(long) (m - 1) - 1);
+        }
+    }
+
+    lval* v = lval_alloc(LVAL_NUM);
+    v->num = neg ? LONG_MIN : LONG_MAX;
+    v->nlimbs = n;
+    v->limbs = d;
+    return v;
+}
+
+
+/* Compare magnitudes, -1, 0 or 1 */
+static int lbig_cmp_mag(lbig* a, lbig* b) {
+    if (a->n != b->n) { return a->n < b->n ? -1 : 1; }
+
+    for (int i = a->n-1; i >= 0; i--) {
+        if (a->d[i] != b->d[i]) { return a->d[i] < b->d[i] ? -1 : 1; }
+    }
+    return 0;
+}
+
+
+/* |a| + |b| */
+static lbig lbig_add_mag(lbig* a, lbig* b) {
+    if (a->n < b->n) { lbig* t = a; a = b; b = t; }
+
+    lbig r = { 0, a->n + 1, lbig_alloc(a->n + 1) };
+    dlimb carry = 0;
+
+    for (int i = 0; i < a->n; i++) {
+        carry += (dlimb) a->d[i] + (i < b->n ? b->d[i] : 0);
+        r.d[i] = (limb) carry;
+        carry >>= LIMB_BITS;
+    }
+    r.d[a->n] = (limb) carry;
+
+    return r;
+}
+
+
+/* |a| - |b|, where |a| >= |b| */
+static lbig lbig_sub_mag(lbig* a, lbig* b) {
+    lbig r = { 0, a->n, lbig_alloc(a->n) };
+    limb borrow = 0;
+
+    for (int i = 0; i < a->n; i++) {
+        dlimb s = (dlimb) (i < b->n ? b->d[i] : 0) + borrow;
+        r.d[i] = (limb) (a->d[i] - s);
+        borrow = a->d[i] < s;
+    }
+
+    return r;
+}
+
+
+/* |a| * |b|, schoolbook */
+static lbig lbig_mul_mag(lbig* a, lbig* b) {
+    lbig r = { 0, a->n + b->n, lbig_alloc(a->n + b->n) };
+
+    for (int i = 0; i < a->n; i++) {
+        dlimb carry = 0;
+        dlimb x = a->d[i];
+        if (!x) { continue; }
+
+        for (int j = 0; j < b->n; j++) {
+            carry += x * b->d[j] + r.d[i+j];
+            r.d[i+j] = (limb) carry;
+            carry >>= LIMB_BITS;
+        }
+        r.d[i + b->n] = (limb) carry;
+    }
+
+    return r;
+}
+
+
+/**
+ * Quotient and remainder of |a| / |b|, where |a| >= |b| > 0
+ * Knuth's algorithm D: the divisor is shifted so its top limb has the
+ * high bit set, which keeps every guessed quotient limb within two of
+ * the real one
+ */
+static void lbig_divmod_mag(lbig* a, lbig* b, lbig* q, lbig* r) {
+    int m = a->n;
+    int n = b->n;
+
+    q->neg = r->neg = 0;
+    q->n = m - n + 1;
+    q->d = lbig_alloc(q->n);
+    r->n = n;
+    r->d = lbig_alloc(n);
+
+    /* A single limb divisor needs none of the above */
+    if (n == 1) {
+        dlimb k = 0;
+        for (int j = m-1; j >= 0; j--) {
+            dlimb t = (k << LIMB_BITS) | a->d[j];
+            q->d[j] = (limb) (t / b->d[0]);
+            k = t % b->d[0];
+        }
+        r->d[0] = (limb) k;
+        return;
+    }
+
+    int s = __builtin_clz(b->d[n-1]);
+    limb* vn = lbig_alloc(n);
+    limb* un = lbig_alloc(m + 1);
+
+    for (int i = n-1; i > 0; i--) {
+        vn[i] = (b->d[i] << s) | (s ? b->d[i-1] >> (LIMB_BITS - s) : 0);
+    }
+    vn[0] = b->d[0] << s;
+
+    un[m] = s ? a->d[m-1] >> (LIMB_BITS - s) : 0;
+    for (int i = m-1; i > 0; i--) {
+        un[i] = (a->d[i] << s) | (s ? a->d[i-1] >> (LIMB_BITS - s) : 0);
+    }
+    un[0] = a->d[0] << s;
+
+    for (int j = m - n; j >= 0; j--) {
+
+        /* Guess the quotient limb from the top two limbs */
+        dlimb top = ((dlimb) un[j+n] << LIMB_BITS) | un[j+n-1];
+        dlimb qhat = top / vn[n-1];
+        dlimb rhat = top % vn[n-1];
+
+        while (qhat >> LIMB_BITS ||
+                qhat * vn[n-2] > ((rhat << LIMB_BITS) | un[j+n-2])) {
+            qhat--;
+            rhat += vn[n-1];
+            if (rhat >> LIMB_BITS) { break; }
+        }
+
+        /* Multiply and subtract */
+        int64_t k = 0;
+        int64_t t;
+        for (int i = 0; i < n; i++) {
+            dlimb p = qhat * vn[i];
+            t = (int64_t) un[i+j] - k - (int64_t) (p & 0xFFFFFFFFUL);
+            un[i+j] = (limb) t;
+            k = (int64_t) (p >> LIMB_BITS) - (t >> LIMB_BITS);
+        }
+        t = (int64_t) un[j+n] - k;
+        un[j+n] = (limb) t;
+
+        q->d[j] = (limb) qhat;
+
+        /* Subtracted one time too many, add it back */
+        if (t < 0) {
+            q->d[j]--;
+
+            dlimb carry = 0;
+            for (int i = 0; i < n; i++) {
+                carry += (dlimb) un[i+j] + vn[i];
+                un[i+j] = (limb) carry;
+                carry >>= LIMB_BITS;
+            }
+            un[j+n] += (limb) carry;
+        }
+    }
+
+    /* Shift the remainder back */
+    for (int i = 0; i < n-1; i++) {
+        r->d[i] = (un[i] >> s) | (s ? un[i+1] << (LIMB_BITS - s) : 0);
+    }
+    r->d[n-1] = un[n-1] >> s;
+
+    free(vn);
+    free(un);
+}
+
+
+/* Signed sum */
+static lval* lbig_add(lbig* a, lbig* b) {
+    if (a->neg == b->neg) {
+        lbig r = lbig_add_mag(a, b);
+        return lbig_value(a->neg, r.d, r.n);
+    }
+
+    /* Opposite signs: the larger magnitude wins */
+    if (lbig_cmp_mag(a, b) >= 0) {
+        lbig r = lbig_sub_mag(a, b);
+        return lbig_value(a->neg, r.d, r.n);
+    }
+
+    lbig r = lbig_sub_mag(b, a);
+    return lbig_value(b->neg, r.d, r.n);
+}
+
+
+/* Quotient truncated towards zero, or the remainder with the sign of "a" */
+static lval* lbig_div(lbig* a, lbig* b, int mod) {
+    if (lbig_cmp_mag(a, b) < 0) {
+        if (!mod) { return lval_num(0); }
+
+        limb* d = lbig_alloc(a->n);
+        memcpy(d, a->d, sizeof(limb) * a->n);
+        return lbig_value(a->neg, d, a->n);
+    }
+
+    lbig q, r;
+    lbig_divmod_mag(a, b, &q, &r);
+
+    if (mod) {
+        free(q.d);
+        return lbig_value(a->neg, r.d, r.n);
+    }
+
+    free(r.d);
+    return lbig_value(a->neg != b->neg, q.d, q.n);
+}
+
+
+/* "a" to a non negative power that fits in a long, by squaring */
+static lval* lbig_pow(lbig* a, unsigned long e) {
+    int neg = a->neg && (e & 1);
+
+    lbig r = { 0, 1, lbig_alloc(1) };
+    r.d[0] = 1;
+
+    lbig x = { 0, a->n, lbig_alloc(a->n) };
+    memcpy(x.d, a->d, sizeof(limb) * a->n);
+
+    while (e) {
+        if (e & 1) {
+            lbig t = lbig_mul_mag(&r, &x);
+            free(r.d);
+            r = t;
+            while (r.n && !r.d[r.n-1]) { r.n--; }
+        }
+
+        e >>= 1;
+        if (!e) { break; }
+
+        lbig t = lbig_mul_mag(&x, &x);
+        free(x.d);
+        x = t;
+        while (x.n && !x.d[x.n-1]) { x.n--; }
+    }
+
+    free(x.d);
+    return lbig_value(neg, r.d, r.n);
+}
+
+
+/**
+ * Apply an arithmetic LBOP_* operator to two Numbers of any size
+ * Division by zero is left to the caller
+ */
+lval* lval_big_op(int op, lval* x, lval* y) {
+    limb xb[2], yb[2];
+    lbig a = lbig_of(x, xb);
+    lbig b = lbig_of(y, yb);
+
+    switch (op) {
+        case LBOP_ADD:
+            return lbig_add(&a, &b);
+
+        case LBOP_SUB:
+            b.neg = !b.neg;
+            return lbig_add(&a, &b);
+
+        case LBOP_MUL: {
+            lbig r = lbig_mul_mag(&a, &b);
+            return lbig_value(a.neg != b.neg, r.d, r.n);
+        }
+
+        case LBOP_DIV: return lbig_div(&a, &b, 0);
+        case LBOP_MOD: return lbig_div(&a, &b, 1);
+
+        case LBOP_POW:
+            /* 0, 1 and -1 stay small whatever the exponent */
+            if (b.n == 0) { return lval_num(1); }
+            if (a.n == 0) {
+                return b.neg ? lval_err("Division By Zero!") : lval_num(0);
+            }
+            if (a.n == 1 && a.d[0] == 1) {
+                return lval_num(a.neg && (b.d[0] & 1) ? -1 : 1);
+            }
+
+            /* Anything else has a fraction for a reciprocal, truncated */
+            if (b.neg) { return lval_num(0); }
+
+            /* Keep the result within what the limb count can hold */
+            if (lval_is_big(y) ||
+                    lval_to_num(y) > INT_MAX / LIMB_BITS / (a.n + 1)) {
+                return lval_err("Number too large!");
+            }
+            return lbig_pow(&a, lval_to_num(y));
+    }
+
+    return lval_err("Unknown operator!");
+}
+
+
+/* Compare two Numbers of any size, -1, 0 or 1 */
+int lval_big_cmp(lval* x, lval* y) {
+    limb xb[2], yb[2];
+    lbig a = lbig_of(x, xb);
+    lbig b = lbig_of(y, yb);
+
+    if (a.neg != b.neg) { return a.neg ? -1 : 1; }
+
+    int c = lbig_cmp_mag(&a, &b);
+    return a.neg ? -c : c;
+}
+
+
+/* Number from a string of decimal digits with an optional sign */
+lval* lval_big_read(char* s) {
+    int neg = *s == '-';
+    if (neg) { s++; }
+
+    int len = strlen(s);
+    int n = 0;
+    limb* d = lbig_alloc(len / LIMB_TEN_DIGITS + 1);
+
+    /* Multiply in a chunk of up to nine digits at a time */
+    while (*s) {
+        limb chunk = 0;
+        limb scale = 1;
+        for (int i = 0; i < LIMB_TEN_DIGITS && *s; i++, s++) {
+            chunk = chunk * 10 + (*s - '0');
+            scale *= 10;
+        }
+
+        dlimb carry = chunk;
+        for (int i = 0; i < n; i++) {
+            carry += (dlimb) d[i] * scale;
+            d[i] = (limb) carry;
+            carry >>= LIMB_BITS;
+        }
+        if (carry) { d[n++] = (limb) carry; }
+    }
+
+    return lbig_value(neg, d, n);
+}
+
+
+/* Print a bignum in decimal */
+void lval_big_print(lval* v) {
+    int n = v->nlimbs;
+    limb* d = lbig_alloc(n);
+    memcpy(d, v->limbs, sizeof(limb) * n);
+
+    /* Nine digits come out of every division, least significant first */
+    limb* chunks = lbig_alloc(n * LIMB_BITS / 29 + 1);
+    int count = 0;
+
+    while (n) {
+        dlimb k = 0;
+        for (int j = n-1; j >= 0; j--) {
+            dlimb t = (k << LIMB_BITS) | d[j];
+            d[j] = (limb) (t / LIMB_TEN);
+            k = t % LIMB_TEN;
+        }
+        chunks[count++] = (limb) k;
+
+        while (n && !d[n-1]) { n--; }
+    }
+
+    if (v->num < 0) { putchar('-'); }
+    printf("%u", (unsigned) chunks[count-1]);
+    for (int i = count-2; i >= 0; i--) { printf("%09u", (unsigned) chunks[i]); }
+
+    free(chunks);
+    free(d);
+}
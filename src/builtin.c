@@ -10,17 +10,26 @@
 #include "../include/repl.h"
 
 
+/* Names of the operators, by LBOP_* value, for the error messages */
+char* lbop_names[LBOP_COUNT] = {
+    "+", "-", "*", "/", "%", "^",
+    ">", "<", ">=", "<=", "==", "!=",
+    "def", "="
+};
+
+
 lval* builtin_def(lenv* e, lval* a) {
-    return builtin_var(e, a, "def");
+    return builtin_var(e, a, LBOP_DEF);
 }
 
 
 lval* builtin_put(lenv* e, lval* a) {
-    return builtin_var(e, a, "=");
+    return builtin_var(e, a, LBOP_PUT);
 }
 
 
-lval* builtin_var(lenv* e, lval* a, char* func) {
+lval* builtin_var(lenv* e, lval* a, int op) {
+    char* func = lbop_names[op];
     LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
 
     /* First argument is symbol list */
@@ -28,10 +37,10 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
 
     /* Ensure all elements of first list are symbols */
     for (int i = 0; i < syms->count; i++) {
-        LASSERT(a, syms->cell[i]->type == LVAL_SYM,
+        LASSERT(a, lval_type(syms->cell[i]) == LVAL_SYM,
             "Function 'def' cannot define non-symbol. "
             "Got %s, Expected %s.",
-            ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+            ltype_name(lval_type(syms->cell[i])), ltype_name(LVAL_SYM));
     }
 
     /* Check correct number of symbols and values */
@@ -42,11 +51,9 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
 
     /* Assign copies of values to symbols */
     for (int i = 0; i < syms->count; i++) {
-        if (strcmp(func, "def") == 0) {
+        if (op == LBOP_DEF) {
             lenv_def(e, syms->cell[i], a->cell[i+1]);
-        }
-
-        if (strcmp(func, "=") == 0) {
+        } else {
             lenv_put(e, syms->cell[i], a->cell[i+1]);
         }
     }
@@ -57,75 +64,75 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
 
 
 lval* builtin_add(lenv* e, lval* a) {
-    return builtin_op(e, a, "+");
+    return builtin_op(e, a, LBOP_ADD);
 }
 
 
 lval* builtin_sub(lenv* e, lval* a) {
-    return builtin_op(e, a, "-");
+    return builtin_op(e, a, LBOP_SUB);
 }
 
 
 lval* builtin_mul(lenv* e, lval* a) {
-    return builtin_op(e, a, "*");
+    return builtin_op(e, a, LBOP_MUL);
 }
 
 
 lval* builtin_div(lenv* e, lval* a) {
-    return builtin_op(e, a, "/");
+    return builtin_op(e, a, LBOP_DIV);
 }
 
 
 lval* builtin_mod(lenv* e, lval* a) {
-    return builtin_op(e, a, "%");
+    return builtin_op(e, a, LBOP_MOD);
 }
 
 
 lval* builtin_pow(lenv* e, lval* a) {
-    return builtin_op(e, a, "^");
+    return builtin_op(e, a, LBOP_POW);
 }
 
 
 lval* builtin_gt(lenv* e, lval* a) {
-    return builtin_ord(e, a, ">");
+    return builtin_ord(e, a, LBOP_GT);
 }
 
 
 lval* builtin_lt(lenv* e, lval* a) {
-    return builtin_ord(e, a, "<");
+    return builtin_ord(e, a, LBOP_LT);
 }
 
 
 lval* builtin_ge(lenv* e, lval* a) {
-    return builtin_ord(e, a, ">=");
+    return builtin_ord(e, a, LBOP_GE);
 }
 
 
 lval* builtin_le(lenv* e, lval* a) {
-    return builtin_ord(e, a, "<=");
+    return builtin_ord(e, a, LBOP_LE);
 }
 
 
-lval* builtin_ord(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    LASSERT_TYPE(op, a, 0, LVAL_NUM);
-    LASSERT_TYPE(op, a, 1, LVAL_NUM);
+lval* builtin_ord(lenv* e, lval* a, int op) {
+    LASSERT_NUM(lbop_names[op], a, 2);
+    LASSERT_TYPE(lbop_names[op], a, 0, LVAL_NUM);
+    LASSERT_TYPE(lbop_names[op], a, 1, LVAL_NUM);
 
-    int r;
-    if (strcmp(op, ">") == 0) {
-        r = (a->cell[0]->num > a->cell[1]->num);
-    }
+    /* Numbers beyond a long compare by sign and magnitude */
+    long x = lval_to_num(a->cell[0]);
+    long y = lval_to_num(a->cell[1]);
 
-    if (strcmp(op, "<") == 0) {
-        r = (a->cell[0]->num < a->cell[1]->num);
+    if (lval_is_big(a->cell[0]) || lval_is_big(a->cell[1])) {
+        x = lval_big_cmp(a->cell[0], a->cell[1]);
+        y = 0;
     }
 
-    if (strcmp(op, ">=") == 0) {
-        r = (a->cell[0]->num >= a->cell[1]->num);
-    }
-    
-    if (strcmp(op, "<=") == 0) {
-        r = (a->cell[0]->num <= a->cell[1]->num);
+    int r;
+    switch (op) {
+        case LBOP_GT: r = (x > y); break;
+        case LBOP_LT: r = (x < y); break;
+        case LBOP_GE: r = (x >= y); break;
+        default:      r = (x <= y); break;
     }
 
     lval_del(a);
@@ -133,20 +140,34 @@ lval* builtin_ord(lenv* e, lval* a, char* op) {
 }
 
 
+/* Lists this long or longer compare hashes before their elements */
+#define LVAL_HASH_MIN 16
+
+
 int lval_eq(lval* x, lval* y) {
 
+    /* Immediates are equal exactly when their bits are */
+    if (x == y) { return 1; }
+    if (lval_is_fixnum(x) || lval_is_fixnum(y)) { return 0; }
+
     /* Different Types are always unequal */
     if (x->type != y->type) { return 0; }
 
     /* Compare Based upon type */
     switch (x->type) {
-        /* Compare Number Values */
-        case LVAL_NUM: return (x->num == y->num);
+        /* Compare boxed Number Values */
+        case LVAL_NUM:
+            if (x->limbs || y->limbs) { return lval_big_cmp(x, y) == 0; }
+            return (x->num == y->num);
+
 
         /* Compare String Values */
         case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
-        case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
+        case LVAL_SYM: return (x->sym == y->sym);
         case LVAL_STR: return (strcmp(x->str, y->str) == 0);
+        case LVAL_VEC: return lval_vec_eq(x, y);
+        case LVAL_MAP:
+        case LVAL_SET: return lval_map_eq(x, y);
 
         /* If builtin compare, otherwise compare formals and body */
         case LVAL_FUN:
@@ -162,6 +183,12 @@ int lval_eq(lval* x, lval* y) {
         case LVAL_SEXPR:
             if (x->count != y->count) { return 0; }
 
+            /* Views of the same cells hold the same elements */
+            if (x->cell == y->cell) { return 1; }
+
+            /* Long lists tell each other apart by hash, cached after the first time */
+            if (x->count >= LVAL_HASH_MIN && lval_hash(x) != lval_hash(y)) { return 0; }
+
             for (int i = 0; i < x->count; i++) {
                 /* If any element not equal then whole list not equal */
                 if (!lval_eq(x->cell[i], y->cell[i])) { return 0; }
@@ -173,17 +200,11 @@ int lval_eq(lval* x, lval* y) {
 }
 
 
-lval* builtin_cmp(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-
-    int r;
-    if (strcmp(op, "==") == 0) {
-        r = lval_eq(a->cell[0], a->cell[1]);
-    }
+lval* builtin_cmp(lenv* e, lval* a, int op) {
+    LASSERT_NUM(lbop_names[op], a, 2);
 
-    if (strcmp(op, "!=") == 0) {
-        r = !lval_eq(a->cell[0], a->cell[1]);
-    }
+    int r = lval_eq(a->cell[0], a->cell[1]);
+    if (op == LBOP_NE) { r = !r; }
 
     lval_del(a);
     return lval_num(r);
@@ -191,12 +212,12 @@ lval* builtin_cmp(lenv* e, lval* a, char* op) {
 
 
 lval* builtin_eq(lenv* e, lval* a) {
-    return builtin_cmp(e, a, "==");
+    return builtin_cmp(e, a, LBOP_EQ);
 }
 
 
 lval* builtin_ne(lenv* e, lval* a) {
-    return builtin_cmp(e, a, "!=");
+    return builtin_cmp(e, a, LBOP_NE);
 }
 
 
@@ -226,3 +247,20 @@ lval* builtin_error(lenv* e, lval* a) {
     lval_del(a);
     return err;
 }
+
+
+lval* builtin_max_depth(lenv* e, lval* a) {
+    LASSERT_NUM("max-depth", a, 1);
+    LASSERT_TYPE("max-depth", a, 0, LVAL_NUM);
+
+    long n = lval_to_num(a->cell[0]);
+    LASSERT(a, n > 0 && n <= INT_MAX,
+            "Function 'max-depth' passed invalid depth %li.", n);
+
+    /* Set the limit on nested lambda calls and return the old one */
+    lval* x = lval_num(lvm_max_depth);
+    lvm_max_depth = n;
+
+    lval_del(a);
+    return x;
+}
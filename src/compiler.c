@@ -0,0 +1,207 @@
+/**********************************************************************
+ *
+ * Contains the bytecode compiler used by the virtual machine (vm.c)
+ *
+ * An expression compiles to code that leaves its value on the stack:
+ *  - symbols load their binding
+ *  - s-expressions push every child and then call, so the checks of
+ *    lval_eval_sexpr happen once at run time on the evaluated values
+ *  - (if c {a} {b}) is compiled inline: both branches become code and
+ *    a plain call is kept as fallback in case "if" was redefined
+ *  - the last call of the code, also through the branches of an if, is
+ *    a tail call that the VM runs without growing the C stack
+ *  - everything else is a constant
+ *
+ * Constants and symbols are borrowed from the compiled expression, so
+ * the expression has to outlive its code
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "../include/repl.h"
+
+
+static void lcode_emit(lcode* c, lword w) {
+    if (c->count == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 16;
+        c->ops = realloc(c->ops, sizeof(lword) * c->cap);
+    }
+    c->ops[c->count++] = w;
+}
+
+
+static void lcode_op(lcode* c, int op) {
+    lword w; w.op = op;
+    lcode_emit(c, w);
+}
+
+
+static void lcode_arg(lcode* c, int arg) {
+    lword w; w.arg = arg;
+    lcode_emit(c, w);
+}
+
+
+static void lcode_val(lcode* c, lval* v) {
+    lword w; w.val = v;
+    lcode_emit(c, w);
+}
+
+
+/* Keep track of the deepest the stack gets */
+static void lcode_push(lcode* c, int n) {
+    c->sp += n;
+    if (c->sp > c->depth) { c->depth = c->sp; }
+}
+
+
+static void lcode_expr(lcode* c, lval* v, int tail);
+
+
+/**
+ * Compile the children of a list as the s-expression they would form
+ * In tail position the value is returned right away, so the call is
+ * made with LOP_TAIL
+ */
+static void lcode_sexpr(lcode* c, lval* v, int tail) {
+
+    /* Interned name of the only builtin compiled inline */
+    static char* sym_if = NULL;
+    if (!sym_if) { sym_if = lsym_intern("if"); }
+
+    /* Empty Expression */
+    if (v->count == 0) {
+        lcode_op(c, LOP_EMPTY);
+        lcode_push(c, 1);
+        return;
+    }
+
+    /* Single Expression */
+    if (v->count == 1) {
+        lcode_expr(c, v->cell[0], tail);
+        return;
+    }
+
+    /* If with literal branches: test in place and jump to either one */
+    if (v->count == 4 &&
+            lval_type(v->cell[0]) == LVAL_SYM && v->cell[0]->sym == sym_if &&
+            lval_type(v->cell[2]) == LVAL_QEXPR &&
+            lval_type(v->cell[3]) == LVAL_QEXPR) {
+
+        lcode_expr(c, v->cell[0], 0);
+        lcode_expr(c, v->cell[1], 0);
+
+        lcode_op(c, LOP_IF);
+        int branch = c->count;
+        lcode_arg(c, 0);
+        lcode_arg(c, 0);
+
+        /* Both the function and the condition are gone in the branches */
+        int sp = c->sp - 2;
+
+        c->sp = sp;
+        lcode_sexpr(c, v->cell[2], tail);
+        lcode_op(c, LOP_JUMP);
+        int then_end = c->count;
+        lcode_arg(c, 0);
+
+        c->ops[branch].arg = c->count;
+        c->sp = sp;
+        lcode_sexpr(c, v->cell[3], tail);
+        lcode_op(c, LOP_JUMP);
+        int else_end = c->count;
+        lcode_arg(c, 0);
+
+        /* Fallback to a normal call with the branches as arguments */
+        c->ops[branch+1].arg = c->count;
+        c->sp = sp + 2;
+        lcode_expr(c, v->cell[2], 0);
+        lcode_expr(c, v->cell[3], 0);
+        lcode_op(c, tail ? LOP_TAIL : LOP_CALL);
+        lcode_arg(c, 4);
+        c->sp -= 3;
+
+        c->ops[then_end].arg = c->count;
+        c->ops[else_end].arg = c->count;
+        return;
+    }
+
+    /* Evaluate Children, then call the first with the rest */
+    for (int i = 0; i < v->count; i++) { lcode_expr(c, v->cell[i], 0); }
+
+    lcode_op(c, tail ? LOP_TAIL : LOP_CALL);
+    lcode_arg(c, v->count);
+    c->sp -= v->count - 1;
+}
+
+
+static void lcode_expr(lcode* c, lval* v, int tail) {
+    switch (lval_type(v)) {
+        case LVAL_SYM:
+            lcode_op(c, LOP_LOAD);
+            lcode_val(c, v);
+
+            /* Global value cache, empty until the first load */
+            lcode_val(c, NULL);
+            lcode_arg(c, 0);
+            c->ops[c->count-1].stamp = 0;
+            break;
+
+        case LVAL_SEXPR:
+            lcode_sexpr(c, v, tail);
+            return;
+
+        default:
+            lcode_op(c, LOP_CONST);
+            lcode_val(c, v);
+            break;
+    }
+
+    lcode_push(c, 1);
+}
+
+
+static lcode* lcode_new(void) {
+    lcode* c = malloc(sizeof(lcode));
+    c->refs = 1;
+    c->count = 0;
+    c->cap = 0;
+    c->ops = NULL;
+    c->sp = 0;
+    c->depth = 0;
+    return c;
+}
+
+
+/* Code evaluating one expression */
+lcode* lcode_compile(lval* v) {
+    lcode* c = lcode_new();
+    lcode_expr(c, v, 1);
+    lcode_op(c, LOP_RETURN);
+    return c;
+}
+
+
+/* Code evaluating the body of a lambda, a Q-Expression run as an S-Expression */
+lcode* lcode_compile_body(lval* body) {
+    lcode* c = lcode_new();
+    lcode_sexpr(c, body, 1);
+    lcode_op(c, LOP_RETURN);
+    return c;
+}
+
+
+lcode* lcode_copy(lcode* c) {
+    c->refs++;
+    return c;
+}
+
+
+void lcode_del(lcode* c) {
+    if (--c->refs > 0) { return; }
+    free(c->ops);
+    free(c);
+}
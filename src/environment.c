@@ -30,11 +30,55 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "eval", builtin_eval);
     lenv_add_builtin(e, "join", builtin_join);
 
+    /* List Library */
+    lenv_add_builtin(e, "len", builtin_len);
+    lenv_add_builtin(e, "nth", builtin_nth);
+    lenv_add_builtin(e, "last", builtin_last);
+    lenv_add_builtin(e, "take", builtin_take);
+    lenv_add_builtin(e, "drop", builtin_drop);
+    lenv_add_builtin(e, "split", builtin_split);
+    lenv_add_builtin(e, "elem", builtin_elem);
+    lenv_add_builtin(e, "map", builtin_map);
+    lenv_add_builtin(e, "filter", builtin_filter);
+    lenv_add_builtin(e, "foldl", builtin_foldl);
+    lenv_add_builtin(e, "sum", builtin_sum);
+    lenv_add_builtin(e, "product", builtin_product);
+
     /* Variable Functions */
     lenv_add_builtin(e, "def", builtin_def);
     lenv_add_builtin(e, "=", builtin_put);
     lenv_add_builtin(e, "\\", builtin_lambda);
 
+    /* Vector Functions */
+    lenv_add_builtin(e, "vec", builtin_vec);
+    lenv_add_builtin(e, "vec-len", builtin_vec_len);
+    lenv_add_builtin(e, "vec-get", builtin_vec_get);
+    lenv_add_builtin(e, "vec-slice", builtin_vec_slice);
+    lenv_add_builtin(e, "vec-sum", builtin_vec_sum);
+    lenv_add_builtin(e, "vec-min", builtin_vec_min);
+    lenv_add_builtin(e, "vec-max", builtin_vec_max);
+    lenv_add_builtin(e, "vec-dot", builtin_vec_dot);
+
+    /* Map Functions */
+    lenv_add_builtin(e, "map-get", builtin_map_get);
+    lenv_add_builtin(e, "map-has", builtin_map_has);
+    lenv_add_builtin(e, "map-put", builtin_map_put);
+    lenv_add_builtin(e, "map-del", builtin_map_del);
+    lenv_add_builtin(e, "map-keys", builtin_map_keys);
+    lenv_add_builtin(e, "map-vals", builtin_map_vals);
+    lenv_add_builtin(e, "map-size", builtin_map_size);
+
+    /* Set Functions */
+    lenv_add_builtin(e, "set", builtin_set);
+    lenv_add_builtin(e, "set-has", builtin_set_has);
+    lenv_add_builtin(e, "set-add", builtin_set_add);
+    lenv_add_builtin(e, "set-del", builtin_set_del);
+    lenv_add_builtin(e, "set-list", builtin_set_list);
+    lenv_add_builtin(e, "set-size", builtin_set_size);
+    lenv_add_builtin(e, "set-union", builtin_set_union);
+    lenv_add_builtin(e, "set-inter", builtin_set_inter);
+    lenv_add_builtin(e, "set-diff", builtin_set_diff);
+
     /* Mathematical Functions */
     lenv_add_builtin(e, "+", builtin_add);
     lenv_add_builtin(e, "-", builtin_sub);
@@ -56,4 +100,7 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "load", builtin_load);
     lenv_add_builtin(e, "error", builtin_error);
     lenv_add_builtin(e, "print", builtin_print);
+
+    /* Evaluator */
+    lenv_add_builtin(e, "max-depth", builtin_max_depth);
 }
@@ -16,10 +16,11 @@
 
 
 lval* lval_add(lval* v, lval* x) {
-    v->count++;
+    lval_reserve(v, 1);
 
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count-1] = x;
+    v->cell[v->count++] = x;
+    v->hash = 0;
+    LGC_WRITE(v);
 
     return v;
 }
@@ -27,86 +28,170 @@ lval* lval_add(lval* v, lval* x) {
 
 lval* lval_eval(lenv* e, lval* v) {
 
-    if (v->type == LVAL_SYM) {
+    if (lval_type(v) == LVAL_SYM) {
 
         lval* x = lenv_get(e, v);
         lval_del(v);
         return x;
     }
 
-    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
+    if (lval_type(v) == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
     return v;
 }
 
 
 lval* lval_pop(lval* v, int i) {
+    lval_own_cells(v);
+
     /* Find the item at "i" */
     lval* x = v->cell[i];
 
     /* Shift the memory following the item at "i" over the top of it */
     memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
 
-    /* Decrease the count of items in the list */
+    /* Decrease the count of items in the list, keeping the room */
     v->count--;
-
-    /* Reallocate the memory used */
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+    v->hash = 0;
     return x;
 }
 
 
 lval* lval_take(lval* v, int i) {
-    lval* x = lval_pop(v, i);
+    /* Keep a reference to the item and drop the rest of the list */
+    lval* x = lval_copy(v->cell[i]);
     lval_del(v);
     return x;
 }
 
 
-lval* builtin_op(lenv* e, lval* a, char* op) {
+/* "x" to the power "n" when it fits in a long, truncating reciprocals */
+static int lval_pow_long(long x, long n, long* r) {
+    if (n < 0) {
+        if (x == 0) { return 0; }
+        *r = (x == 1 || x == -1) ? ((x == -1 && (n & 1)) ? -1 : 1) : 0;
+        return 1;
+    }
+
+    /* Exponentiation by squaring, giving up on the first overflow */
+    long p = 1;
+    while (n) {
+        if ((n & 1) && __builtin_mul_overflow(p, x, &p)) { return 0; }
+        n >>= 1;
+        if (n && __builtin_mul_overflow(x, x, &x)) { return 0; }
+    }
+
+    *r = p;
+    return 1;
+}
+
+
+lval* builtin_op(lenv* e, lval* a, int op) {
 
-    /* Ensure all arguments are numbers */
+    /* Ensure all arguments are numbers, or vectors for + - * / */
+    int vec = 0;
     for (int i = 0; i < a->count; i++) {
-        LASSERT_TYPE(op, a, i, LVAL_NUM);
+        if (lval_type(a->cell[i]) == LVAL_VEC && op <= LBOP_DIV) { vec = 1; continue; }
+        LASSERT_TYPE(lbop_names[op], a, i, LVAL_NUM);
     }
 
-    /* Pop the first element */
-    lval* x = lval_pop(a, 0);
+    if (vec) { return lval_vec_op(op, a); }
+
+    lval** y = a->cell;
+    int n = a->count;
+    long x = lval_to_num(y[0]);
+    long t;
+    int i = 1;
 
     /* If no arguments and sub then perform unary negation */
-    if ((strcmp(op, "-") == 0) && a->count == 0) { x->num = -x->num; }
+    if (op == LBOP_SUB && n == 1) {
+        lval* r = lval_is_big(y[0]) || x == LONG_MIN
+            ? lval_big_op(LBOP_SUB, lval_num(0), y[0])
+            : lval_num(-x);
 
-    /* While there are still elements remaining */
-    while (a->count > 0) {
+        lval_del(a);
+        return r;
+    }
 
-        /* Pop the next element */
-        lval* y = lval_pop(a, 0);
+    /**
+     * Fold over plain longs while nothing overflows, picking the
+     * operation once and folding in its own loop, and only build the
+     * result at the end
+     */
+    if (!lval_is_big(y[0])) {
+        switch (op) {
+            case LBOP_ADD:
+                for (; i < n && !lval_is_big(y[i]); i++) {
+                    if (__builtin_add_overflow(x, lval_to_num(y[i]), &t)) { break; }
+                    x = t;
+                }
+                break;
+
+            case LBOP_SUB:
+                for (; i < n && !lval_is_big(y[i]); i++) {
+                    if (__builtin_sub_overflow(x, lval_to_num(y[i]), &t)) { break; }
+                    x = t;
+                }
+                break;
+
+            case LBOP_MUL:
+                for (; i < n && !lval_is_big(y[i]); i++) {
+                    if (__builtin_mul_overflow(x, lval_to_num(y[i]), &t)) { break; }
+                    x = t;
+                }
+                break;
+
+            case LBOP_POW:
+                for (; i < n && !lval_is_big(y[i]); i++) {
+                    if (!lval_pow_long(x, lval_to_num(y[i]), &t)) { break; }
+                    x = t;
+                }
+                break;
 
-        /* Perform operation */
-        if (strcmp(op, "+") == 0) { x->num += y->num; }
-        if (strcmp(op, "-") == 0) { x->num -= y->num; }
+            case LBOP_DIV:
+            case LBOP_MOD:
+                for (; i < n && !lval_is_big(y[i]); i++) {
+                    long d = lval_to_num(y[i]);
 
-        if (strcmp(op, "*") == 0) { x->num *= y->num; }
-        if (strcmp(op, "%") == 0) { x->num %= y->num; }
+                    if (d == 0) {
+                        lval_del(a);
+                        return lval_err("Division By Zero!");
+                    }
 
-        if (strcmp(op, "^") == 0) { x->num = pow(x->num, y->num); }
-        if (strcmp(op, "/") == 0) {
+                    /* The one quotient of two longs that is not a long */
+                    if (d == -1) {
+                        if (op == LBOP_MOD) { x = 0; continue; }
+                        if (x == LONG_MIN) { break; }
+                    }
 
-            if (y->num == 0) {
-                lval_del(x); 
-                x = lval_err("Division By Zero!"); 
+                    if (op == LBOP_DIV) { x /= d; } else { x %= d; }
+                }
                 break;
-            } else {
-                x->num /= y->num;
-            }
         }
 
-        /* Delete element now finished with */
-        lval_del(y);
+        if (i == n) {
+            lval_del(a);
+            return lval_num(x);
+        }
+    }
+
+    /* Carry on from the first operand or result that did not fit */
+    lval* r = lval_is_big(y[0]) ? lval_copy(y[0]) : lval_num(x);
+
+    for (; i < n && lval_type(r) != LVAL_ERR; i++) {
+        if ((op == LBOP_DIV || op == LBOP_MOD) && lval_to_num(y[i]) == 0) {
+            lval_del(r);
+            lval_del(a);
+            return lval_err("Division By Zero!");
+        }
+
+        lval* z = lval_big_op(op, r, y[i]);
+        lval_del(r);
+        r = z;
     }
 
     /* Delete input expression and return result */
     lval_del(a);
-    return x;
+    return r;
 }
 
 
@@ -115,12 +200,9 @@ lval* builtin_head(lenv* e, lval* a) {
     LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
     LASSERT_NOT_EMPTY("head", a, 0);
 
-    /* Otherwise take first argument */
+    /* Otherwise take first argument and keep only its first element */
     lval* v = lval_take(a, 0);
-
-    while (v->count > 1) { lval_del(lval_pop(v, 1)); }
-
-    return v;
+    return lval_slice(v, 0, 1);
 }
 
 
@@ -129,18 +211,16 @@ lval* builtin_tail(lenv* e, lval* a) {
     LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
     LASSERT_NOT_EMPTY("tail", a, 0);
 
-    /* Take first argument */
+    /* Take first argument and view all but its first element */
     lval* v = lval_take(a, 0);
-
-    /* Delete first element and return */
-    lval_del(lval_pop(v, 0));
-
-    return v;
+    return lval_slice(v, 1, v->count);
 }
 
 
 lval* builtin_list(lenv* e, lval* a) {
+    a = lval_unshare(a);
     a->type = LVAL_QEXPR;
+    a->hash = 0;
     return a;
 }
 
@@ -149,8 +229,9 @@ lval* builtin_eval(lenv* e, lval* a) {
     LASSERT_NUM("eval", a, 1);
     LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
 
-    lval* x = lval_take(a, 0);
+    lval* x = lval_unshare(lval_take(a, 0));
     x->type = LVAL_SEXPR;
+    x->hash = 0;
     
     return lval_eval(e, x);
 }
@@ -164,6 +245,11 @@ lval* builtin_join(lenv* e, lval* a) {
 
     lval* x = lval_pop(a, 0);
 
+    /* Make room for every list being joined at once */
+    int total = 0;
+    for (int i = 0; i < a->count; i++) { total += a->cell[i]->count; }
+    x = lval_extend(x, total);
+
     while (a->count) {
         lval* y = lval_pop(a, 0);
         x = lval_join(x, y);
@@ -175,14 +261,33 @@ lval* builtin_join(lenv* e, lval* a) {
 
 lval* lval_join(lval* x, lval* y) {
 
-    /* For each cell in 'y' add it to 'x' */
-    for (int i = 0; i < y->count; i++) {
-        x = lval_add(x, y->cell[i]);
+    /* Grow 'x' once for all of 'y', the cells go after its own */
+    int n = y->count;
+    x = lval_extend(x, n);
+    lval** cell = x->cell + x->count;
+
+    /* If 'y' or its cells are shared they have to be shared too */
+    if (y->refs > 1 || y->base) {
+        for (int i = 0; i < n; i++) { cell[i] = lval_copy(y->cell[i]); }
+
+    /* Otherwise move the cells of 'y' over to 'x', leaving it empty */
+    } else {
+        memcpy(cell, y->cell, sizeof(lval*) * n);
+        y->count = 0;
     }
 
-    free(y->cell);
-    free(y);
+    x->count += n;
+    x->hash = 0;
+
+    /* A view grows the store it views along with it */
+    if (x->base) {
+        x->base->count += n;
+        LGC_WRITE(x->base);
+    } else {
+        LGC_WRITE(x);
+    }
 
+    lval_del(y);
     return x;
 }
 
@@ -191,39 +296,107 @@ lval* lval_join(lval* x, lval* y) {
 
 lval* lval_eval_sexpr(lenv* e, lval* v) {
 
-    /* Evaluate Children */
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
-    }
+    /**
+     * Calls in tail position replace "v" and carry on in this loop, so
+     * they use no C stack. Frames entered on the way belong to the
+     * loop and are released when it returns.
+     */
+    lenv* stop = e;
+    int depth = 0;
+    lval* x;
 
-    /* Error Checking */
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    /* Nested evaluations use the C stack, fail before it runs out */
+    if (!lvm_native_room()) {
+        lval_del(v);
+        return lval_err("Maximum call depth exceeded!");
     }
 
-    /* Empty Expression */
-    if (v->count == 0) { return v; }
+    for (;;) {
+
+        /* Evaluation rewrites the cells in place */
+        v = lval_unshare(v);
+        v->hash = 0;
+
+        /* Keep the half evaluated expression alive for the collector */
+        LGC_PUSH_ROOT(v);
+        LGC_SAFEPOINT(e);
+
+        /* Evaluate Children */
+        for (int i = 0; i < v->count; i++) {
+            v->cell[i] = lval_eval(e, v->cell[i]);
+            LGC_WRITE(v);
+        }
+
+        LGC_POP_ROOTS(1);
+
+        /* Error Checking */
+        int i = 0;
+        while (i < v->count && lval_type(v->cell[i]) != LVAL_ERR) { i++; }
+        if (i < v->count) { x = lval_take(v, i); break; }
 
-    /* Single Expression */
-    if (v->count == 1) { return lval_take(v, 0); }
+        /* Empty Expression */
+        if (v->count == 0) { x = v; break; }
 
-    /* Ensure first element is Symbol */
-    lval* f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
+        /* Single Expression */
+        if (v->count == 1) { x = lval_take(v, 0); break; }
 
-        lval* err = lval_err(
-            "S-Expression starts with incorrect type."
-            "Got %s, Expected %s.",
-            ltype_name(f->type), ltype_name(LVAL_FUN));
+        /* Ensure first element is Symbol */
+        lval* f = lval_pop(v, 0);
+        if (lval_type(f) != LVAL_FUN) {
+
+            x = lval_err(
+                "S-Expression starts with incorrect type."
+                "Got %s, Expected %s.",
+                ltype_name(lval_type(f)), ltype_name(LVAL_FUN));
+
+            lval_del(f); lval_del(v);
+            break;
+        }
 
-        lval_del(f); lval_del(v);
-        return err;
+        /* The chosen branch of an if is in tail position */
+        if (f->builtin == builtin_if) {
+            lval_del(f);
+            v = lval_if_branch(v);
+
+            if (lval_type(v) == LVAL_ERR) { x = v; break; }
+            continue;
+        }
+
+        /* So is the body of a lambda, unless the VM runs lambdas */
+        if (!f->builtin && !lvm_enabled) {
+
+            /* The first lambda entered counts as one nested call */
+            if (!depth && lvm_depth >= lvm_max_depth) {
+                x = lval_err("Maximum call depth exceeded!");
+                lval_del(f); lval_del(v);
+                break;
+            }
+
+            lenv* frame = lval_bind(f, v, &x);
+            if (!frame) { lval_del(f); break; }
+
+            e = lenv_enter(frame, e, stop);
+            if (!depth) { depth = 1; lvm_depth++; }
+
+            v = lval_unshare(lval_copy(f->body));
+            v->type = LVAL_SEXPR;
+            v->hash = 0;
+            lval_del(f);
+            continue;
+        }
+
+        /* Call builtin with operator */
+        LGC_PUSH_ROOT(f);
+        x = lval_call(e, f, v);
+        LGC_POP_ROOTS(1);
+
+        lval_del(f);
+        break;
     }
 
-    /* Call builtin with operator */
-    lval* result = lval_call(e, f, v);
-    lval_del(f);
-    return result;
+    lenv_leave(e, stop);
+    lvm_depth -= depth;
+    return x;
 }
 
 
@@ -236,10 +409,10 @@ lval* builtin_lambda(lenv* e, lval* a) {
 
     /* Check first Q-Expression contains only Symbols */
     for (int i = 0; i < a->cell[0]->count; i++) {
-        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
+        LASSERT(a, (lval_type(a->cell[0]->cell[i]) == LVAL_SYM),
                 "Cannot define non-symbol. "
                 "Got %s, Expected %s.",
-                ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+                ltype_name(lval_type(a->cell[0]->cell[i])), ltype_name(LVAL_SYM));
     }
 
     /* Pop first two arguments and pass them to lval_lambda */
@@ -251,123 +424,165 @@ lval* builtin_lambda(lenv* e, lval* a) {
 }
 
 
-lval* lval_call(lenv* e, lval* f, lval* a) {
+/**
+ * Bind the arguments "a" of the lambda "f" in a fresh frame
+ * Returns the frame once every formal is bound, otherwise NULL with
+ * the partially applied function or an error in "r"
+ */
+lenv* lval_bind(lval* f, lval* a, lval** r) {
 
-    /* If Builtin then simply call that */
-    if (f->builtin) { return f->builtin(e, a); }
+    /* Interned name of the variadic marker */
+    static char* amp = NULL;
+    if (!amp) { amp = lsym_intern("&"); }
+
+    /* Functions are immutable, arguments are bound in a fresh frame */
+    lenv* frame = lenv_copy(f->env);
+    lval* formals = f->formals;
 
     /* Record Argument Counts */
     int given = a->count;
-    int total = f->formals->count;
+    int total = formals->count;
+    int i = 0;
 
     /* While arguments still remain to be processed */
     while (a->count) {
 
         /* If we've ran out of formal arguments to bind */
-        if (f->formals->count == 0) {
-            lval_del(a); return lval_err(
+        if (i == total) {
+            lval_del(a); lenv_del(frame); *r = lval_err(
                 "Function passed too many arguments. "
                 "Got %i, Expected &i.", given, total);
+            return NULL;
         }
 
-        /* Pop the first symbol from the formals */
-        lval* sym = lval_pop(f->formals, 0);
+        /* Take the next symbol from the formals */
+        lval* sym = formals->cell[i++];
 
         /* Special Case to deal with '&' */
-        if (strcmp(sym->sym, "&") == 0) {
+        if (sym->sym == amp) {
 
             /* Ensure '&' is followed by another symbol */
-            if (f->formals->count != 1) {
-                lval_del(a);
-                return lval_err("Function format invalid. "
+            if (total - i != 1) {
+                lval_del(a); lenv_del(frame);
+                *r = lval_err("Function format invalid. "
                     "Symbol '&' not followed by single symbol."); 
+                return NULL;
             }
 
             /* Next formal should be bound to remaing arguments */
-            lval* nsym = lval_pop(f->formals, 0);
-            lenv_put(f->env, nsym, builtin_list(e, a));
-            lval_del(sym); lval_del(nsym);
-
+            lenv_put(frame, formals->cell[i++], builtin_list(NULL, a));
             break;
         }
 
         /* Pop the next argument from the list */
         lval* val = lval_pop(a, 0);
 
-        /* Bind a copy into the function's environment */
-        lenv_put(f->env, sym, val);
-
-        /* Delete symbol and value */
-        lval_del(sym); lval_del(val);
+        /* Bind a copy into the frame */
+        lenv_put(frame, sym, val);
+        lval_del(val);
     }
 
     /* Argument list is now bound so can be cleaned up */
     lval_del(a);
 
     /* If '&' remains in formal list bind to empty list */
-    if (f->formals->count > 0 &&
-            strcmp(f->formals->cell[0]->sym, "&") == 0) {
+    if (i < total && formals->cell[i]->sym == amp) {
 
         /* Check to ensure that & is not passed invalidly */
-        if (f->formals->count != 2) {
-            return lval_err("Function format invalid. "
+        if (total - i != 2) {
+            lenv_del(frame);
+            *r = lval_err("Function format invalid. "
                 "Symbol '&' not followed by single symbol.");
+            return NULL;
         }
 
-        /* Pop and delete '&' symbol */
-        lval_del(lval_pop(f->formals, 0));
-
-        /* Pop next symbol and create empty list */
-        lval* sym = lval_pop(f->formals, 0);
+        /* Bind the symbol after '&' to an empty list */
         lval* val = lval_qexpr();
+        lenv_put(frame, formals->cell[i+1], val);
+        lval_del(val);
+        i += 2;
+    }
 
-        /* Bind to environment and delete */
-        lenv_put(f->env, sym, val);
-        lval_del(sym); lval_del(val);
+    /* If all formals have been bound the frame is ready */
+    if (i == total) { return frame; }
+
+    /* Otherwise return a new function waiting for the remaining formals */
+    lval* g = lval_alloc(LVAL_FUN);
+    g->builtin = NULL;
+    g->env = frame;
+    g->formals = lval_qexpr();
+    g->body = lval_copy(f->body);
+
+    for (; i < total; i++) {
+        lval_add(g->formals, lval_copy(formals->cell[i]));
     }
 
-    /* If all formals have been bound evaluate */
-    if (f->formals->count == 0) {
+    *r = g;
+    return NULL;
+}
 
-        /* Set environment parent to evaluation environment */
-        f->env->par = e;
 
-        /* Evaluate and return */
-        return builtin_eval(
-            f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
+lval* lval_call(lenv* e, lval* f, lval* a) {
+
+    /* If Builtin then simply call that */
+    if (f->builtin) { return f->builtin(e, a); }
 
+    if (lvm_depth >= lvm_max_depth) {
+        lval_del(a);
+        return lval_err("Maximum call depth exceeded!");
+    }
+
+    lval* x;
+    lenv* frame = lval_bind(f, a, &x);
+    if (!frame) { return x; }
+
+    /* Set frame parent to evaluation environment */
+    frame->par = e;
+    frame->glob = e->glob;
+    lvm_depth++;
+
+    /* The VM releases the frame itself, compile the body on the first call */
+    if (lvm_enabled) {
+        if (!f->env->code) { f->env->code = lcode_compile_body(f->body); }
+        x = lvm_run(frame, f->env->code, e);
+
+    /* Otherwise evaluate and drop the frame */
     } else {
-        /* Otherwise return partially evaluated function */
-        return lval_copy(f);
+        x = builtin_eval(frame, lval_add(lval_sexpr(), lval_copy(f->body)));
+        lenv_del(frame);
     }
+
+    lvm_depth--;
+    return x;
 }
 
 
-lval* builtin_if(lenv* e, lval* a) {
+/* Check the arguments of if and return the branch to evaluate, or an error */
+lval* lval_if_branch(lval* a) {
     LASSERT_NUM("if", a, 3);
     LASSERT_TYPE("if", a, 0, LVAL_NUM);
     LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
     LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
 
-    /* Mark Both Expressions as evaluable */
-    lval* x;
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
-
-    if (a->cell[0]->num) {
-        /* If condition is true evaluate first expression */
-        x = lval_eval(e, lval_pop(a, 1));
-    } else {
-        /* Otherwise evaluate second expression */
-        x = lval_eval(e, lval_pop(a, 2));
-    }
-
-    /* Delete argument list and return */
+    /* Pick the branch from the condition */
+    lval* x = lval_pop(a, lval_to_num(a->cell[0]) ? 1 : 2);
     lval_del(a);
+
+    /* Mark it as evaluable, cloning it first if it is shared */
+    x = lval_unshare(x);
+    x->type = LVAL_SEXPR;
+    x->hash = 0;
     return x;
 }
 
 
+lval* builtin_if(lenv* e, lval* a) {
+    lval* x = lval_if_branch(a);
+    if (lval_type(x) == LVAL_ERR) { return x; }
+    return lval_eval(e, x);
+}
+
+
 lval* builtin_load(lenv* e, lval* a) {
     LASSERT_NUM("load", a, 1);
     LASSERT_TYPE("load", a, 0, LVAL_STR);
@@ -381,13 +596,24 @@ lval* builtin_load(lenv* e, lval* a) {
         mpc_ast_delete(r.output);
 
         /* Evaluate each Expression */
+        LGC_PUSH_ROOT(a);
+        LGC_PUSH_ROOT(expr);
+
         while (expr->count) {
-            lval* x = lval_eval(e, lval_pop(expr, 0));
+            LGC_REGION_BEGIN();
+
+            lval* x = lval_pop(expr, 0);
+            x = lvm_enabled ? lvm_eval(e, x) : lval_eval(e, x);
+
             /* If Evaluation leads to error print it */
-            if (x->type == LVAL_ERR) { lval_println(x); }
+            if (lval_type(x) == LVAL_ERR) { lval_println(x); }
             lval_del(x);
+
+            LGC_REGION_END(e);
         }
 
+        LGC_POP_ROOTS(2);
+
         /* Delete expressions and arguments */
         lval_del(expr);
         lval_del(a);
@@ -0,0 +1,383 @@
+/**********************************************************************
+ *
+ * Contains the optional precise mark-sweep collector (make GC=1)
+ *
+ * New nodes are bump allocated out of nursery slabs. A collection
+ * marks from the environment chain of the running evaluation (which
+ * always ends in the global environment), the explicit root stack, the
+ * VM stack and the remembered set, then sweeps:
+ *  - minor: only the nursery is swept, survivors become old and are
+ *    not traced again, so young temporaries die for the cost of a scan
+ *  - major: once the old space doubles everything is traced and swept
+ *
+ * Each top level evaluation (a REPL line or a form of a loaded file)
+ * is a region. Values that become old while it runs are kept on slabs
+ * of their own, and once it is over lgc_region_end traces them again:
+ * those that escaped into the environment (def) are old for good, the
+ * rest of the region's slabs go back to the spares in one sweep instead
+ * of sitting in the old space until a major collection
+ *
+ * Old values are immutable unless someone holds them on the root
+ * stack, the only other stores into them go through lgc_write which
+ * remembers the value until the next collection, or until the region
+ * ends for values older than it
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "../include/repl.h"
+
+
+#ifdef LISPY_GC
+
+
+/* Nodes per slab and nursery slabs filled before collecting */
+#ifndef LGC_SLAB_NODES
+#define LGC_SLAB_NODES      1024
+#endif
+
+#ifndef LGC_NURSERY_SLABS
+#define LGC_NURSERY_SLABS   64
+#endif
+
+
+/* Flags kept in lval->mark */
+#define LGC_MARKED      1
+#define LGC_OLD         2
+#define LGC_FREED       4
+#define LGC_REMEMBERED  8
+#define LGC_REGION      16
+
+
+typedef struct lgc_slab {
+    struct lgc_slab* next;
+    int type;
+    int used;
+    char* nodes;
+} lgc_slab;
+
+
+/* A growable stack of values */
+typedef struct lgc_stack {
+    lval** items;
+    int count;
+    int cap;
+} lgc_stack;
+
+
+/* Slab currently bump allocated from, one per type */
+static lgc_slab* lgc_bump[LVAL_TYPES];
+
+/* Nursery, survivors of the running region, old space and slabs kept for reuse */
+static lgc_slab* lgc_young;
+static lgc_slab* lgc_region;
+static lgc_slab* lgc_old;
+static lgc_slab* lgc_spare;
+
+static int lgc_young_count;
+static int lgc_region_count;
+static int lgc_old_count;
+static int lgc_old_limit = LGC_NURSERY_SLABS;
+
+static int lgc_major;
+static int lgc_ending;
+
+/* Top level evaluations running, a load nests them */
+static int lgc_regions;
+
+static lgc_stack lgc_roots;
+static lgc_stack lgc_remembered;
+static lgc_stack lgc_marking;
+
+
+static void lgc_stack_push(lgc_stack* s, lval* v) {
+    if (s->count == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 256;
+        s->items = realloc(s->items, sizeof(lval*) * s->cap);
+    }
+    s->items[s->count++] = v;
+}
+
+
+/* Start a fresh nursery slab for the given type */
+static lgc_slab* lgc_new_slab(int type) {
+    lgc_slab* s = lgc_spare;
+
+    if (s) {
+        lgc_spare = s->next;
+    } else {
+        s = malloc(sizeof(lgc_slab));
+        s->nodes = NULL;
+    }
+
+    /* Spare slabs may have held nodes of another size */
+    s->nodes = realloc(s->nodes, lval_size(type) * LGC_SLAB_NODES);
+    s->type = type;
+    s->used = 0;
+
+    s->next = lgc_young;
+    lgc_young = s;
+    lgc_young_count++;
+
+    return s;
+}
+
+
+lval* lval_alloc(int type) {
+    lgc_slab* s = lgc_bump[type];
+
+    if (!s || s->used == LGC_SLAB_NODES) {
+        s = lgc_bump[type] = lgc_new_slab(type);
+    }
+
+    /* Bump the next node out of the slab */
+    lval* v = (lval*) (s->nodes + lval_size(type) * s->used++);
+    v->type = type;
+    v->mark = 0;
+    v->refs = 1;
+    return v;
+}
+
+
+/* The payload is already gone, the sweep only has to skip the node */
+void lval_free(lval* v) { v->mark |= LGC_FREED; }
+
+
+void lgc_push_root(lval* v) { lgc_stack_push(&lgc_roots, v); }
+void lgc_pop_roots(int n) { lgc_roots.count -= n; }
+
+
+/* Write barrier: remember old values that may now point at young ones */
+void lgc_write(lval* v) {
+    if ((v->mark & LGC_OLD) && !(v->mark & LGC_REMEMBERED)) {
+        v->mark |= LGC_REMEMBERED;
+        lgc_stack_push(&lgc_remembered, v);
+    }
+}
+
+
+/**
+ * Whether the running collection decides if "v" lives: a minor one
+ * takes old values as live without tracing them, except for those
+ * promoted during the region it ends
+ */
+static int lgc_decides(lval* v) {
+    return lgc_major || !(v->mark & LGC_OLD)
+        || (lgc_ending && (v->mark & LGC_REGION));
+}
+
+
+static void lgc_mark(lval* v) {
+    if (lval_is_fixnum(v)) { return; }
+    if (v->mark & LGC_MARKED) { return; }
+    if (!lgc_decides(v)) { return; }
+
+    v->mark |= LGC_MARKED;
+    lgc_stack_push(&lgc_marking, v);
+}
+
+
+static void lgc_mark_env(lenv* e) {
+    for (int i = 0; i < e->nslots; i++) {
+        if (e->slots[i]) { lgc_mark(e->slots[i]); }
+    }
+
+    for (int i = 0; i < e->cap; i++) {
+        if (e->syms[i]) { lgc_mark(e->vals[i]); }
+    }
+}
+
+
+/* Mark everything a value points at */
+static void lgc_trace(lval* v) {
+    switch (v->type) {
+        case LVAL_FUN:
+            if (!v->builtin) {
+                lgc_mark_env(v->env);
+                lgc_mark(v->formals);
+                lgc_mark(v->body);
+            }
+            break;
+
+        case LVAL_MAP:
+        case LVAL_SET: lval_map_trace(v, lgc_mark); break;
+
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+        case LVAL_CELLS:
+            /* The list a slice views holds its cells */
+            if (v->base) {
+                lgc_mark(v->base);
+                break;
+            }
+            for (int i = 0; i < v->count; i++) { lgc_mark(v->cell[i]); }
+            break;
+    }
+}
+
+
+/* Sweep one slab, returning the number of nodes still alive */
+static int lgc_sweep_slab(lgc_slab* s, int region) {
+    size_t size = lval_size(s->type);
+    int live = 0;
+
+    for (int i = 0; i < s->used; i++) {
+        lval* v = (lval*) (s->nodes + size * i);
+
+        if (v->mark & LGC_FREED) { continue; }
+
+        if (v->mark & LGC_MARKED) {
+            /* Survivors are promoted, into the region unless it is ending */
+            v->mark = (v->mark & ~(LGC_MARKED | LGC_REGION)) | LGC_OLD;
+            if (region) { v->mark |= LGC_REGION; }
+            live++;
+
+        } else if (!lgc_decides(v)) {
+            live++;
+
+        } else {
+            lval_finalize(v);
+            v->mark |= LGC_FREED;
+        }
+    }
+
+    return live;
+}
+
+
+/* Sweep a list of slabs, moving dead ones to the spares and live ones to "to" */
+static void lgc_sweep(lgc_slab* s, lgc_slab** to, int* count, int region) {
+    while (s) {
+        lgc_slab* next = s->next;
+
+        if (lgc_sweep_slab(s, region)) {
+            s->next = *to;
+            *to = s;
+            (*count)++;
+        } else {
+            s->next = lgc_spare;
+            lgc_spare = s;
+        }
+
+        s = next;
+    }
+}
+
+
+/**
+ * Values from before the region that were written while it runs may
+ * point into it, so they stay remembered for the collection ending it,
+ * unless they are gone. Everything else is forgotten.
+ */
+static void lgc_keep_remembered(void) {
+    int kept = 0;
+
+    for (int i = 0; i < lgc_remembered.count; i++) {
+        lval* v = lgc_remembered.items[i];
+
+        if (!lgc_ending && !(v->mark & (LGC_FREED | LGC_REGION))
+                && (!lgc_major || (v->mark & LGC_MARKED))) {
+            lgc_remembered.items[kept++] = v;
+        } else {
+            v->mark &= ~LGC_REMEMBERED;
+        }
+    }
+
+    lgc_remembered.count = kept;
+}
+
+
+static void lgc_collect(lenv* e) {
+
+    lgc_major = !lgc_ending && lgc_old_count + lgc_region_count > lgc_old_limit;
+
+    /* The environment chain ends in the global environment */
+    for (; e; e = e->par) { lgc_mark_env(e); }
+
+    /* Values on the root stack may be old and still being filled in */
+    for (int i = 0; i < lgc_roots.count; i++) {
+        lgc_mark(lgc_roots.items[i]);
+        lgc_trace(lgc_roots.items[i]);
+    }
+
+    /* Values being worked on by the VM */
+    for (int i = 0; i < lvm_sp; i++) { lgc_mark(lvm_stack[i]); }
+
+    /* Old values written since the last collection, unless taken apart
+       since or traced anyway if they are still alive */
+    for (int i = 0; i < lgc_remembered.count; i++) {
+        lval* v = lgc_remembered.items[i];
+        if (!(v->mark & LGC_FREED) && !lgc_decides(v)) { lgc_trace(v); }
+    }
+
+    while (lgc_marking.count) {
+        lgc_trace(lgc_marking.items[--lgc_marking.count]);
+    }
+
+    lgc_keep_remembered();
+
+    /* Take the slabs this collection sweeps off their lists */
+    lgc_slab* young = lgc_young;
+    lgc_slab* region = lgc_region;
+    lgc_slab* old = lgc_old;
+
+    lgc_young = NULL;
+    lgc_young_count = 0;
+
+    if (lgc_major) {
+        lgc_old = NULL;
+        lgc_old_count = 0;
+        lgc_sweep(old, &lgc_old, &lgc_old_count, 0);
+    }
+
+    /* Survivors stay in the region until it ends, then they are old for good */
+    if (lgc_major || lgc_ending) {
+        lgc_region = NULL;
+        lgc_region_count = 0;
+    }
+    if (lgc_ending) {
+        lgc_sweep(region, &lgc_old, &lgc_old_count, 0);
+        lgc_sweep(young, &lgc_old, &lgc_old_count, 0);
+    } else {
+        if (lgc_major) { lgc_sweep(region, &lgc_region, &lgc_region_count, 1); }
+        lgc_sweep(young, &lgc_region, &lgc_region_count, 1);
+    }
+
+    if (lgc_major) {
+        lgc_old_limit = (lgc_old_count + lgc_region_count) * 2;
+        if (lgc_old_limit < LGC_NURSERY_SLABS) {
+            lgc_old_limit = LGC_NURSERY_SLABS;
+        }
+    }
+
+    /* Allocation restarts in fresh slabs */
+    for (int t = 0; t < LVAL_TYPES; t++) { lgc_bump[t] = NULL; }
+}
+
+
+void lgc_safepoint(lenv* e) {
+    if (lgc_young_count > LGC_NURSERY_SLABS) { lgc_collect(e); }
+}
+
+
+void lgc_region_begin(void) { lgc_regions++; }
+
+
+/**
+ * A top level evaluation is over, settle what was promoted while it
+ * ran. Nested ones leave it to the outermost, whose caller may still
+ * be filling in values the collector is not told about.
+ */
+void lgc_region_end(lenv* e) {
+    if (--lgc_regions || !lgc_region) { return; }
+
+    lgc_ending = 1;
+    lgc_collect(e);
+    lgc_ending = 0;
+}
+
+
+#endif
@@ -1,9 +1,13 @@
 /**********************************************************************
  *
- * Contains all the definitions for the constructors of the 
+ * Contains all the definitions for the constructors of the
  * lisp environment struct
- * It is basically a hash table without keys (variable names) and values
- * (their function pointers) 
+ * It is an open addressing hash table from variable names to their
+ * values, with a link to the parent environment
+ * Names are interned symbols so they are hashed and compared by
+ * pointer, and the table doubles whenever it gets half full
+ * Call frames of lambdas also keep an array with one slot per formal,
+ * which references resolved by lval_lambda index directly
  *
  * Author: Joao Pargana
  *
@@ -13,11 +17,105 @@
 #include "../include/repl.h"
 
 
+/* Slots in the first table allocated for an environment */
+#define LENV_MIN_CAP 8
+
+/* Frames with up to this many slots are recycled instead of freed */
+#define LENV_SPARE_SLOTS 8
+
+
+unsigned long lenv_stamp = 1;
+
+/* Freed frames by number of slots, linked through "par" */
+static lenv* lenv_spare[LENV_SPARE_SLOTS+1];
+
+
+/* Home slot of an interned name in a table of "cap" slots */
+static int lenv_slot(char* sym, int cap) {
+    uintptr_t h = (uintptr_t) sym;
+    h = (h >> 4) * 11400714819323198485UL;
+    return (int) (h >> 32) & (cap-1);
+}
+
+
+/* Slot holding "sym", or the empty slot where it would go */
+static int lenv_find(lenv* e, char* sym) {
+    int i = lenv_slot(sym, e->cap);
+    while (e->syms[i] && e->syms[i] != sym) { i = (i+1) & (e->cap-1); }
+    return i;
+}
+
+
+/* Double the table and reinsert every binding */
+static void lenv_grow(lenv* e) {
+    int cap = e->cap ? e->cap * 2 : LENV_MIN_CAP;
+    char** syms = calloc(cap, sizeof(char*));
+    lval** vals = malloc(sizeof(lval*) * cap);
+
+    for (int i = 0; i < e->cap; i++) {
+        if (!e->syms[i]) { continue; }
+
+        int j = lenv_slot(e->syms[i], cap);
+        while (syms[j]) { j = (j+1) & (cap-1); }
+        syms[j] = e->syms[i];
+        vals[j] = e->vals[i];
+    }
+
+    free(e->syms);
+    free(e->vals);
+    e->syms = syms;
+    e->vals = vals;
+    e->cap = cap;
+}
+
+
+/* Slot of the formal named "sym" in a frame, or -1 */
+static int lenv_formal(lenv* e, char* sym) {
+    for (int i = 0; i < e->nslots; i++) {
+        if (e->names[i] == sym) { return i; }
+    }
+    return -1;
+}
+
+
+/* Count one more (or one less) binding of "sym" outside the globals */
+static void lenv_count(lenv* e, char* sym, int n) {
+    if (e->glob != e) { LSYM(sym)->locals += n; }
+}
+
+
+/**
+ * An environment with "n" slots, allocated in one block with the slot
+ * values and then their names following the struct
+ */
+static lenv* lenv_alloc(int n) {
+    lenv* e;
+
+    if (n <= LENV_SPARE_SLOTS && lenv_spare[n]) {
+        e = lenv_spare[n];
+        lenv_spare[n] = e->par;
+        return e;
+    }
+
+    e = malloc(sizeof(lenv) + n * (sizeof(lval*) + sizeof(char*)));
+
+    e->nslots = n;
+    e->slots = (lval**) (e + 1);
+    e->names = (char**) (e->slots + n);
+
+    return e;
+}
+
+
+/* A new global environment */
 lenv* lenv_new(void) {
-    lenv* e = malloc(sizeof(lenv));
+    lenv* e = lenv_alloc(0);
 
     e->par = NULL;
+    e->glob = e;
+    e->code = NULL;
     e->count = 0;
+    e->cap = 0;
     e->syms = NULL;
     e->vals = NULL;
 
@@ -25,77 +123,157 @@ lenv* lenv_new(void) {
 }
 
 
+/* A frame for a lambda taking "formals", linked in when it is called */
+lenv* lenv_frame(lval* formals) {
+    lenv* e = lenv_alloc(formals->count);
+
+    e->par = NULL;
+    e->glob = NULL;
+    e->code = NULL;
+    e->count = 0;
+    e->cap = 0;
+    e->syms = NULL;
+    e->vals = NULL;
+
+    for (int i = 0; i < formals->count; i++) {
+        e->slots[i] = NULL;
+        e->names[i] = formals->cell[i]->sym;
+    }
+
+    return e;
+}
+
+
 void lenv_del(lenv* e) {
 
-    for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
+    for (int i = 0; i < e->nslots; i++) {
+        if (!e->slots[i]) { continue; }
+        lenv_count(e, e->names[i], -1);
+#ifndef LISPY_GC
+        lval_del(e->slots[i]);
+#endif
+    }
+
+    for (int i = 0; i < e->cap; i++) {
+        if (!e->syms[i]) { continue; }
+        lenv_count(e, e->syms[i], -1);
+
+#ifndef LISPY_GC
+        /* Under the collector the values are reclaimed by the sweep */
         lval_del(e->vals[i]);
+#endif
     }
 
+    if (e->code) { lcode_del(e->code); }
+
     free(e->syms);
     free(e->vals);
-    free(e);
+
+    if (e->nslots <= LENV_SPARE_SLOTS) {
+        e->par = lenv_spare[e->nslots];
+        lenv_spare[e->nslots] = e;
+    } else {
+        free(e);
+    }
 }
 
 
 lval* lenv_get(lenv* e, lval* k) {
 
-    /* Iterate over all items in environment */
-    for (int i = 0; i < e->count; i++) {
-        /* Check if the stored string matches the symbol string */
-        /* If it does, return a copy of the value */
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
-        }
+    /* A reference resolved to a slot of this very frame */
+    int s = k->slot;
+    if (s >= 0 && s < e->nslots && e->names[s] == k->sym && e->slots[s]) {
+        return lval_copy(e->slots[s]);
     }
-    /* If no symbol check in parent otherwise error */
-    if (e->par) {
-        return lenv_get(e->par, k);
-    } else {
-        return lval_err("Unbound symbol!");
+
+    /* A name no frame binds can only be global */
+    if (LSYM(k->sym)->locals == 0 && e->glob) { e = e->glob; }
+
+    /* Walk up the environments until one binds the symbol */
+    for (; e; e = e->par) {
+
+        s = lenv_formal(e, k->sym);
+        if (s >= 0 && e->slots[s]) { return lval_copy(e->slots[s]); }
+
+        if (e->count == 0) { continue; }
+
+        /* If it does, return a copy of the value */
+        int i = lenv_find(e, k->sym);
+        if (e->syms[i]) { return lval_copy(e->vals[i]); }
     }
+
+    return lval_err("Unbound symbol!");
 }
 
 
 void lenv_put(lenv* e, lval* k, lval* v) {
 
-    /* Iterate over allitems in environment */
-    /* This is to see if variable already exists */
-    for (int i = 0; i < e->count; i++) {
-
-        /* If variable is found delete item at that position */
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
+    /* Formals of a frame live in their slots */
+    int s = lenv_formal(e, k->sym);
+    if (s >= 0) {
+        if (e->slots[s]) {
+            lval_del(e->slots[s]);
+        } else {
+            lenv_count(e, k->sym, 1);
         }
+        e->slots[s] = lval_copy(v);
+        return;
     }
 
-    /* If no existing entry found allocate space for new entry */
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
+    /* Loads caching the old global value have to look again */
+    if (e->glob == e) { lenv_stamp++; }
+
+    /* Keep the table at most half full */
+    if (2 * (e->count+1) > e->cap) { lenv_grow(e); }
+
+    int i = lenv_find(e, k->sym);
 
-    /* Copy contents of lval and symbol string into new location */
-    e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count-1], k->sym);
+    /* If variable already exists replace its value */
+    if (e->syms[i]) {
+        lval_del(e->vals[i]);
+        e->vals[i] = lval_copy(v);
+        return;
+    }
+
+    /* Otherwise fill the empty slot with the name and a copy of the value */
+    e->syms[i] = k->sym;
+    e->vals[i] = lval_copy(v);
+    e->count++;
+    lenv_count(e, k->sym, 1);
 }
 
 
 lenv* lenv_copy(lenv* e) {
-    lenv* n = malloc(sizeof(lenv));
+    lenv* n = lenv_alloc(e->nslots);
 
     n->par = e->par;
+    n->glob = e->glob == e ? n : e->glob;
+    n->code = e->code ? lcode_copy(e->code) : NULL;
     n->count = e->count;
+    n->cap = e->cap;
+
+    memcpy(n->names, e->names, sizeof(char*) * n->nslots);
+
+    for (int i = 0; i < n->nslots; i++) {
+        n->slots[i] = e->slots[i];
+        if (!e->slots[i]) { continue; }
+        lval_copy(e->slots[i]);
+        lenv_count(n, n->names[i], 1);
+    }
+
+    n->syms = NULL;
+    n->vals = NULL;
+    if (!e->cap) { return n; }
 
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(lval*) * n->count);
+    /* Same layout, so the slots can be copied over as they are */
+    n->syms = malloc(sizeof(char*) * n->cap);
+    n->vals = malloc(sizeof(lval*) * n->cap);
+    memcpy(n->syms, e->syms, sizeof(char*) * n->cap);
 
-    for (int i = 0; i < e->count; i++) {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
+    for (int i = 0; i < e->cap; i++) {
+        if (!e->syms[i]) { continue; }
         n->vals[i] = lval_copy(e->vals[i]);
+        lenv_count(n, e->syms[i], 1);
     }
 
     return n;
@@ -109,3 +287,43 @@ void lenv_def(lenv* e, lval* k, lval* v) {
     /* Put value in e */
     lenv_put(e, k, v);
 }
+
+
+/* Whether "frame" binds every name "e" binds, hiding all of "e" */
+static int lenv_shadows(lenv* frame, lenv* e) {
+    if (e->count) { return 0; }
+
+    for (int i = 0; i < e->nslots; i++) {
+        if (e->slots[i] && lenv_formal(frame, e->names[i]) < 0) { return 0; }
+    }
+    return 1;
+}
+
+
+/**
+ * Link the frame of a tail call made from "e" into the chain
+ * Frames below "stop" belong to the loop running the tail calls. If
+ * the new frame hides everything "e" binds nothing can see "e" any
+ * more, so it is dropped instead of growing the chain.
+ */
+lenv* lenv_enter(lenv* frame, lenv* e, lenv* stop) {
+    frame->glob = e->glob;
+    frame->par = e;
+
+    if (e != stop && lenv_shadows(frame, e)) {
+        frame->par = e->par;
+        lenv_del(e);
+    }
+
+    return frame;
+}
+
+
+/* Release the frames a tail call loop entered, back up to "stop" */
+void lenv_leave(lenv* e, lenv* stop) {
+    while (e != stop) {
+        lenv* par = e->par;
+        lenv_del(e);
+        e = par;
+    }
+}
@@ -0,0 +1,285 @@
+/**********************************************************************
+ *
+ * Contains the list library builtins
+ *
+ * These used to be recursive functions in the prelude, built out of
+ * head, tail and join, which made most of them quadratic. Here they
+ * walk the cell array once. Elements are evaluated on the way out the
+ * same way "fst" does, so they behave like the prelude versions.
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "../include/repl.h"
+
+
+/* Number of items "take", "drop" or "split" count, clamped to the list */
+static long lval_count_arg(lval* n, lval* l) {
+    long x = lval_to_num(n);
+    if (x < 0) { return 0; }
+    return x < l->count ? x : l->count;
+}
+
+
+/* Item "i" of list "l" as "fst" sees it, evaluated */
+static lval* lval_item(lenv* e, lval* l, int i) {
+    return lval_eval(e, lval_copy(l->cell[i]));
+}
+
+
+/* Call "f" with one or two arguments, taking them */
+static lval* lval_apply(lenv* e, lval* f, lval* x, lval* y) {
+    lval* a = lval_add(lval_sexpr(), x);
+    if (y) { a = lval_add(a, y); }
+    return lval_call(e, f, a);
+}
+
+
+lval* builtin_take(lenv* e, lval* a) {
+    LASSERT_NUM("take", a, 2);
+    LASSERT_TYPE("take", a, 0, LVAL_NUM);
+    LASSERT_TYPE("take", a, 1, LVAL_QEXPR);
+
+    /* View the first "n" elements */
+    long n = lval_count_arg(a->cell[0], a->cell[1]);
+    lval* v = lval_take(a, 1);
+    return lval_slice(v, 0, n);
+}
+
+
+lval* builtin_drop(lenv* e, lval* a) {
+    LASSERT_NUM("drop", a, 2);
+    LASSERT_TYPE("drop", a, 0, LVAL_NUM);
+    LASSERT_TYPE("drop", a, 1, LVAL_QEXPR);
+
+    /* View everything after the first "n" elements */
+    long n = lval_count_arg(a->cell[0], a->cell[1]);
+    lval* v = lval_take(a, 1);
+    return lval_slice(v, n, v->count);
+}
+
+
+lval* builtin_split(lenv* e, lval* a) {
+    LASSERT_NUM("split", a, 2);
+    LASSERT_TYPE("split", a, 0, LVAL_NUM);
+    LASSERT_TYPE("split", a, 1, LVAL_QEXPR);
+
+    long n = lval_count_arg(a->cell[0], a->cell[1]);
+    lval* v = lval_take(a, 1);
+
+    /* Both halves view the one list */
+    lval* x = lval_add(lval_qexpr(), lval_slice(lval_copy(v), 0, n));
+    return lval_add(x, lval_slice(v, n, v->count));
+}
+
+
+lval* builtin_len(lenv* e, lval* a) {
+    LASSERT_NUM("len", a, 1);
+    LASSERT_TYPE("len", a, 0, LVAL_QEXPR);
+
+    lval* x = lval_num(a->cell[0]->count);
+    lval_del(a);
+    return x;
+}
+
+
+lval* builtin_nth(lenv* e, lval* a) {
+    LASSERT_NUM("nth", a, 2);
+    LASSERT_TYPE("nth", a, 0, LVAL_NUM);
+    LASSERT_TYPE("nth", a, 1, LVAL_QEXPR);
+
+    long n = lval_to_num(a->cell[0]);
+    LASSERT(a, n >= 0 && n < a->cell[1]->count,
+            "Function 'nth' passed index %li for a list of %i.",
+            n, a->cell[1]->count);
+
+    LGC_PUSH_ROOT(a);
+    lval* x = lval_item(e, a->cell[1], n);
+    LGC_POP_ROOTS(1);
+
+    lval_del(a);
+    return x;
+}
+
+
+lval* builtin_last(lenv* e, lval* a) {
+    LASSERT_NUM("last", a, 1);
+    LASSERT_TYPE("last", a, 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("last", a, 0);
+
+    LGC_PUSH_ROOT(a);
+    lval* x = lval_item(e, a->cell[0], a->cell[0]->count - 1);
+    LGC_POP_ROOTS(1);
+
+    lval_del(a);
+    return x;
+}
+
+
+lval* builtin_elem(lenv* e, lval* a) {
+    LASSERT_NUM("elem", a, 2);
+
+    /* Sets look the element up instead */
+    if (lval_type(a->cell[1]) == LVAL_SET) {
+        int found = lval_set_has(a->cell[1], a->cell[0]);
+        lval_del(a);
+        return lval_num(found);
+    }
+
+    LASSERT_TYPE("elem", a, 1, LVAL_QEXPR);
+
+    lval* l = a->cell[1];
+    int found = 0;
+
+    LGC_PUSH_ROOT(a);
+    for (int i = 0; i < l->count && !found; i++) {
+        lval* y = lval_item(e, l, i);
+        found = lval_eq(a->cell[0], y);
+        lval_del(y);
+    }
+    LGC_POP_ROOTS(1);
+
+    lval_del(a);
+    return lval_num(found);
+}
+
+
+lval* builtin_map(lenv* e, lval* a) {
+    LASSERT_NUM("map", a, 2);
+    LASSERT_TYPE("map", a, 0, LVAL_FUN);
+    LASSERT_TYPE("map", a, 1, LVAL_QEXPR);
+
+    lval* f = a->cell[0];
+    lval* l = a->cell[1];
+    lval* x = lval_qexpr();
+
+    /* The arguments and the results so far stay alive while "f" runs */
+    LGC_PUSH_ROOT(a);
+    LGC_PUSH_ROOT(x);
+
+    for (int i = 0; i < l->count; i++) {
+        lval* y = lval_apply(e, f, lval_item(e, l, i), NULL);
+
+        if (lval_type(y) == LVAL_ERR) {
+            lval_del(x);
+            x = y;
+            break;
+        }
+
+        x = lval_add(x, y);
+    }
+
+    LGC_POP_ROOTS(2);
+    lval_del(a);
+    return x;
+}
+
+
+lval* builtin_filter(lenv* e, lval* a) {
+    LASSERT_NUM("filter", a, 2);
+    LASSERT_TYPE("filter", a, 0, LVAL_FUN);
+    LASSERT_TYPE("filter", a, 1, LVAL_QEXPR);
+
+    lval* f = a->cell[0];
+    lval* l = a->cell[1];
+    lval* x = lval_qexpr();
+
+    LGC_PUSH_ROOT(a);
+    LGC_PUSH_ROOT(x);
+
+    for (int i = 0; i < l->count; i++) {
+        lval* y = lval_apply(e, f, lval_item(e, l, i), NULL);
+
+        /* The predicate picks a branch of an if in the prelude version */
+        if (lval_type(y) != LVAL_NUM) {
+            lval_del(x);
+            x = lval_type(y) == LVAL_ERR ? lval_copy(y) : lval_err(
+                "Function 'filter' predicate returned incorrect type."
+                "Got %s, Expected %s.",
+                ltype_name(lval_type(y)), ltype_name(LVAL_NUM));
+
+            lval_del(y);
+            break;
+        }
+
+        /* Keep the element itself, not what it evaluated to */
+        if (lval_to_num(y)) { x = lval_add(x, lval_copy(l->cell[i])); }
+        lval_del(y);
+    }
+
+    LGC_POP_ROOTS(2);
+    lval_del(a);
+    return x;
+}
+
+
+lval* builtin_foldl(lenv* e, lval* a) {
+    LASSERT_NUM("foldl", a, 3);
+    LASSERT_TYPE("foldl", a, 0, LVAL_FUN);
+    LASSERT_TYPE("foldl", a, 2, LVAL_QEXPR);
+
+    /* The accumulator lives in the arguments, where the collector sees it */
+    a = lval_unshare(a);
+    LGC_PUSH_ROOT(a);
+
+    lval* f = a->cell[0];
+    lval* l = a->cell[2];
+
+    for (int i = 0; i < l->count; i++) {
+        lval* z = lval_apply(e, f, lval_copy(a->cell[1]), lval_item(e, l, i));
+        lval_del(a->cell[1]);
+        a->cell[1] = z;
+        a->hash = 0;
+        LGC_WRITE(a);
+
+        if (lval_type(z) == LVAL_ERR) { break; }
+    }
+
+    LGC_POP_ROOTS(1);
+    return lval_take(a, 1);
+}
+
+
+/* Apply an arithmetic builtin to "z" followed by every item of the list */
+static lval* lval_reduce(lenv* e, lval* a, char* name, lbuiltin op, long z) {
+    LASSERT_NUM(name, a, 1);
+    LASSERT_TYPE(name, a, 0, LVAL_QEXPR);
+
+    lval* l = a->cell[0];
+    lval* x = lval_sexpr();
+    lval_reserve(x, l->count + 1);
+    x = lval_add(x, lval_num(z));
+
+    LGC_PUSH_ROOT(a);
+    LGC_PUSH_ROOT(x);
+
+    for (int i = 0; i < l->count; i++) {
+        lval* y = lval_item(e, l, i);
+
+        if (lval_type(y) == LVAL_ERR) {
+            lval_del(x);
+            x = y;
+            break;
+        }
+
+        x = lval_add(x, y);
+    }
+
+    LGC_POP_ROOTS(2);
+    lval_del(a);
+
+    return lval_type(x) == LVAL_ERR ? x : op(e, x);
+}
+
+
+lval* builtin_sum(lenv* e, lval* a) {
+    return lval_reduce(e, a, "sum", builtin_add, 0);
+}
+
+
+lval* builtin_product(lenv* e, lval* a) {
+    return lval_reduce(e, a, "product", builtin_mul, 1);
+}
@@ -15,32 +15,66 @@
 #include "../include/repl.h"
 
 
-/* Construct a pointer to a new Number lval */
+/* Construct a new Number lval, immediate unless it is out of range */
 lval* lval_num(long x) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_NUM;
+    if (x >= LVAL_FIXNUM_MIN && x <= LVAL_FIXNUM_MAX) {
+        return lval_fixnum(x);
+    }
+
+    lval* v = lval_alloc(LVAL_NUM);
     v->num = x;
+    v->nlimbs = 0;
+    v->limbs = NULL;
     return v;
 }
 
 
+/* Point the string of "v" at a copy of "s", inside the node when it fits */
+static void lval_set_chars(lval* v, char* s) {
+    size_t n = strlen(s) + 1;
+    v->str = n <= LVAL_INLINE_CHARS ? v->chars : malloc(n);
+    memcpy(v->str, s, n);
+}
+
+
+/* Free the string of an Error or String lval unless it is inline */
+static void lval_free_chars(lval* v) {
+    if (v->str != v->chars) { free(v->str); }
+}
+
+
+/* Give list "x" room for "n" cells, inside the node when they fit */
+static void lval_set_cells(lval* x, int n) {
+    if (n <= LVAL_INLINE_CELLS) {
+        x->cell = x->small;
+        x->cap = LVAL_INLINE_CELLS;
+    } else {
+        x->cell = malloc(sizeof(lval*) * n);
+        x->cap = n;
+    }
+}
+
+
+/* Free the cell array of a list unless it is inline */
+static void lval_free_cells(lval* v) {
+    if (v->cell != v->small) { free(v->cell); }
+}
+
+
 /* Construct a pointer to a new Error lval */
 lval* lval_err(char* fmt, ...) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_ERR;
+    lval* v = lval_alloc(LVAL_ERR);
 
     /* Create a va list and initialize it */
     va_list va;
     va_start(va, fmt);
 
-    /* Allocate 512 bytes of space */
-    v->err = malloc(512);
-
     /* printf the error string with a maximum of 511 characters */
-    vsnprintf(v->err, 511, fmt, va);
+    char buffer[512];
+    vsnprintf(buffer, 511, fmt, va);
 
-    /* Reallocate to number of bytes actually used */
-    v->err = realloc(v->err, strlen(v->err)+1);
+    /* Keep only the bytes actually used */
+    lval_set_chars(v, buffer);
 
     /* Cleanup out va list */
     va_end(va);
@@ -49,13 +83,12 @@ lval* lval_err(char* fmt, ...) {
 }
 
 
-/* Contruct a pointer to a new Symbol lval */
+/* Contruct a pointer to a new Symbol lval holding the interned name */
 lval* lval_sym(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
+    lval* v = lval_alloc(LVAL_SYM);
 
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
+    v->sym = lsym_intern(s);
+    v->slot = -1;
 
     return v;
 }
@@ -63,11 +96,13 @@ lval* lval_sym(char* s) {
 
 /* A pointer to a new empty Sexpr lval */
 lval* lval_sexpr(void) {
-    lval* v = malloc(sizeof(lval));
-    
-    v->type = LVAL_SEXPR;
+    lval* v = lval_alloc(LVAL_SEXPR);
+
     v->count = 0;
-    v->cell = NULL;
+    v->cell = v->small;
+    v->cap = LVAL_INLINE_CELLS;
+    v->base = NULL;
+    v->hash = 0;
 
     return v;
 }
@@ -75,35 +110,77 @@ lval* lval_sexpr(void) {
 
 /* A pointer to a new empty Qexpr lval */
 lval* lval_qexpr(void) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc(LVAL_QEXPR);
 
-    v->type = LVAL_QEXPR;
     v->count = 0;
-    v->cell = NULL;
+    v->cell = v->small;
+    v->cap = LVAL_INLINE_CELLS;
+    v->base = NULL;
+    v->hash = 0;
 
     return v;
 }
 
 
 lval* lval_fun(lbuiltin func) {
-    lval* v = malloc(sizeof(lval));
-
-    v->type = LVAL_FUN;
+    lval* v = lval_alloc(LVAL_FUN);
     v->builtin = func;
 
     return v;
 }
 
 
+/**
+ * Values are immutable once shared, so copying one is just taking
+ * another reference to it
+ */
 lval* lval_copy(lval* v) {
+    if (!lval_is_fixnum(v)) { v->refs++; }
+    return v;
+}
+
+
+/* Get a value that is safe to mutate in place, cloning it if shared */
+lval* lval_unshare(lval* v) {
+    if (lval_is_fixnum(v)) { return v; }
+
+    if (v->refs == 1) {
+        if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) { lval_own_cells(v); }
+        return v;
+    }
+
+    /* Drop our reference to the shared original and use a clone */
+    lval* x = lval_clone(v);
+    v->refs--;
+    return x;
+}
+
 
-    lval* x = malloc(sizeof(lval));
-    x->type = v->type;
+/* Fresh top level copy of a value, sharing all its children */
+lval* lval_clone(lval* v) {
+
+    /* Immediates are their own copy */
+    if (lval_is_fixnum(v)) { return v; }
+
+    /* Maps and sets share their trie, changing it copies the nodes on the way */
+    if (v->type == LVAL_MAP || v->type == LVAL_SET) { return lval_map_clone(v); }
+
+    lval* x = lval_alloc(v->type);
 
     switch (v->type) {
 
         /* Copy Functions and Numbers Directly */
-        case LVAL_NUM: x->num = v->num; break;
+        case LVAL_NUM:
+            x->num = v->num;
+            x->nlimbs = v->nlimbs;
+            x->limbs = NULL;
+
+            if (v->limbs) {
+                x->limbs = malloc(sizeof(uint32_t) * v->nlimbs);
+                memcpy(x->limbs, v->limbs, sizeof(uint32_t) * v->nlimbs);
+            }
+            break;
+
         case LVAL_FUN: 
 
             if (v->builtin) {
@@ -117,24 +194,26 @@ lval* lval_copy(lval* v) {
             }
             break;
 
-        /* Copy strings using malloc and strcpy */
+        /* Copy strings, inline if they were */
         case LVAL_ERR:
-            x->err = malloc(strlen(v->err) + 1);
-            strcpy(x->err, v->err); break;
+        case LVAL_STR: lval_set_chars(x, v->str); break;
 
-        case LVAL_SYM:
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym); break;
+        /* Interned names are shared */
+        case LVAL_SYM: x->sym = v->sym; x->slot = v->slot; break;
 
-        case LVAL_STR:
-            x->str = malloc(strlen(v->str) + 1);
-            strcpy(x->str, v->str); break;
+        case LVAL_VEC:
+            x->length = v->length;
+            x->ints = malloc(sizeof(int64_t) * (v->length ? v->length : 1));
+            memcpy(x->ints, v->ints, sizeof(int64_t) * v->length);
+            break;
 
-        /* Copy lists by copying each sub-expression */
+        /* Copy lists by sharing each sub-expression */
         case LVAL_SEXPR:
         case LVAL_QEXPR:
             x->count = v->count;
-            x->cell = malloc(sizeof(lval*) * x->count);
+            lval_set_cells(x, x->count);
+            x->base = NULL;
+            x->hash = v->hash;
 
             for (int i = 0; i < x->count; i++) {
                 x->cell[i] = lval_copy(v->cell[i]);
@@ -146,11 +225,165 @@ lval* lval_copy(lval* v) {
 }
 
 
+/* Slices shorter than this copy their cells instead of holding on to the list */
+#define LVAL_SLICE_MIN 8
+
+
+/**
+ * The cells of list "v" from "start" up to, but not including, "end",
+ * taking "v". Shares the cell array of "v" (or of the list "v" is a
+ * slice of) instead of copying it, which is fine as lists are never
+ * mutated while shared: anything that wants to calls lval_own_cells.
+ */
+lval* lval_slice(lval* v, int start, int end) {
+    if (start == 0 && end == v->count) { return v; }
+
+    lval* x;
+
+    if (end - start < LVAL_SLICE_MIN) {
+        x = lval_alloc(v->type);
+        x->count = end - start;
+        lval_set_cells(x, x->count);
+        x->base = NULL;
+        x->hash = 0;
+
+        for (int i = 0; i < x->count; i++) {
+            x->cell[i] = lval_copy(v->cell[start + i]);
+        }
+
+        lval_del(v);
+        return x;
+    }
+
+    x = lval_alloc(v->type);
+    x->count = end - start;
+    x->cap = 0;
+    x->cell = v->cell + start;
+    x->hash = 0;
+
+    /* Slices of slices view the original list, passing on our reference */
+    if (v->base) {
+        x->base = lval_copy(v->base);
+        lval_del(v);
+    } else {
+        x->base = v;
+    }
+
+    return x;
+}
+
+
+/* Give a list we hold the only reference to a cell array of its own */
+void lval_own_cells(lval* v) {
+    if (!v->base) { return; }
+
+    lval* base = v->base;
+    lval** cell = v->cell;
+
+    lval_set_cells(v, v->count);
+    for (int i = 0; i < v->count; i++) { v->cell[i] = lval_copy(cell[i]); }
+
+    v->base = NULL;
+    lval_del(base);
+    LGC_WRITE(v);
+}
+
+
+/**
+ * Make room for "n" more cells in list "v", at least doubling the
+ * array when it grows so that appending one at a time only reallocs
+ * a logarithmic number of times
+ */
+void lval_reserve(lval* v, int n) {
+    lval_own_cells(v);
+    if (v->count + n <= v->cap) { return; }
+
+    int cap = v->cap < 4 ? 4 : v->cap * 2;
+    if (cap < v->count + n) { cap = v->count + n; }
+
+    /* Cells kept inside the node move out to the heap */
+    if (v->cell == v->small) {
+        v->cell = malloc(sizeof(lval*) * cap);
+        memcpy(v->cell, v->small, sizeof(lval*) * v->count);
+    } else {
+        v->cell = realloc(v->cell, sizeof(lval*) * cap);
+    }
+    v->cap = cap;
+}
+
+
+/* Lists sharing this many cells grow in a store instead of being copied */
+#define LVAL_STORE_MIN 64
+
+
+/* A new list viewing "count" cells of "store" from "start" */
+static lval* lval_view(int type, lval* store, int start, int count) {
+    lval* x = lval_alloc(type);
+    x->count = count;
+    x->cap = 0;
+    x->cell = store->cell + start;
+    x->base = lval_copy(store);
+    x->hash = 0;
+    return x;
+}
+
+
+/**
+ * List "x" with room to append "n" more cells, taking "x". Small lists
+ * and lists we hold the only reference to grow their own cell array.
+ * Large shared ones are copied once into a LVAL_CELLS store with room
+ * to spare and viewed as a slice of it. Appending to a view that ends
+ * where its store's cells end then writes into the store in place:
+ * older views of the store never look past their own count, so they
+ * are left as they were and every version stays valid.
+ */
+lval* lval_extend(lval* x, int n) {
+    lval* s = x->base;
+
+    if (s && s->type == LVAL_CELLS && s->count + n <= s->cap
+          && x->cell + x->count == s->cell + s->count) {
+        if (x->refs == 1) { return x; }
+
+        lval* v = lval_view(x->type, s, x->cell - s->cell, x->count);
+        lval_del(x);
+        return v;
+    }
+
+    if (x->count + n < LVAL_STORE_MIN || (x->refs == 1 && !x->base)) {
+        x = lval_unshare(x);
+        lval_reserve(x, n);
+        return x;
+    }
+
+    /* Leave as much room again to append in place later on */
+    s = lval_alloc(LVAL_CELLS);
+    s->count = x->count;
+    s->cap = 2 * (x->count + n);
+    s->cell = malloc(sizeof(lval*) * s->cap);
+    s->base = NULL;
+    s->hash = 0;
+
+    for (int i = 0; i < x->count; i++) { s->cell[i] = lval_copy(x->cell[i]); }
+
+    lval* v = lval_view(x->type, s, 0, x->count);
+    lval_del(x);
+    lval_del(s);
+    return v;
+}
+
+
 /* Delete a lval pointer */
 void lval_del(lval* v) {
-    
+
+    /* Immediates own no memory */
+    if (lval_is_fixnum(v)) { return; }
+
+    /* Only the last reference frees the value */
+    if (--v->refs > 0) { return; }
+
+#ifndef LISPY_GC
     switch (v->type) {
-        case LVAL_NUM: break;           // Do nothing for number
+        case LVAL_NUM: free(v->limbs); break;
         case LVAL_FUN: 
 
             if (!v->builtin) {
@@ -160,53 +393,124 @@ void lval_del(lval* v) {
             }
             break;
 
-        /* Free the strings */
-        case LVAL_ERR: free(v->err); break;
-        case LVAL_SYM: free(v->sym); break;
-        case LVAL_STR: free(v->str); break;
+        /* Free the strings, interned names live forever */
+        case LVAL_ERR:
+        case LVAL_STR: lval_free_chars(v); break;
+        case LVAL_VEC: free(v->ints); break;
+        case LVAL_MAP:
+        case LVAL_SET: lval_map_del(v); break;
 
         case LVAL_QEXPR:
         case LVAL_SEXPR:
+        case LVAL_CELLS:
+            /* A slice only lets go of the list it views */
+            if (v->base) {
+                lval_del(v->base);
+                break;
+            }
+
             /* Free all elements inside recursively */
             for (int i = 0; i < v->count; i++) {
                 lval_del(v->cell[i]);
             }
 
             /* And itself */
-            free(v->cell);
+            lval_free_cells(v);
+            break;
+
+    }
+
+    /* Finally give the "lval" node itself back to the pool */
+    lval_free(v);
+#endif
+}
+
+
+/**
+ * Free the memory owned by a dead node without touching its children
+ * Used by the collector, which decides the fate of every node itself
+ */
+void lval_finalize(lval* v) {
+    switch (v->type) {
+        case LVAL_NUM: free(v->limbs); break;
+
+        case LVAL_FUN:
+            if (!v->builtin) { lenv_del(v->env); }
             break;
 
+        case LVAL_ERR:
+        case LVAL_STR: lval_free_chars(v); break;
+        case LVAL_VEC: free(v->ints); break;
+        case LVAL_MAP:
+        case LVAL_SET: lval_map_finalize(v); break;
+
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+        case LVAL_CELLS:
+            if (!v->base) { lval_free_cells(v); }
+            break;
+    }
+}
+
+
+/**
+ * Copy of a lambda body where every symbol naming one of the formals
+ * records that formal's slot, and every other symbol records none
+ * Nested lambdas resolve their own bodies again when they are built
+ */
+static lval* lval_resolve(lval* v, lval* formals) {
+    lval* x;
+
+    switch (lval_type(v)) {
+        case LVAL_SYM:
+            x = lval_alloc(LVAL_SYM);
+            x->sym = v->sym;
+            x->slot = -1;
+
+            for (int i = 0; i < formals->count; i++) {
+                if (formals->cell[i]->sym == v->sym) { x->slot = i; break; }
+            }
+            return x;
+
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            x = lval_alloc(v->type);
+            x->count = v->count;
+            lval_set_cells(x, x->count);
+            x->base = NULL;
+            x->hash = 0;
+
+            for (int i = 0; i < x->count; i++) {
+                x->cell[i] = lval_resolve(v->cell[i], formals);
+            }
+            return x;
     }
 
-    /* Finally free the memory allocated for the "lval" struct itself */
-    free(v);
+    return lval_copy(v);
 }
 
 
 lval* lval_lambda(lval* formals, lval* body) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval* v = lval_alloc(LVAL_FUN);
 
     /* Set Builtin to NULL */
     v->builtin = NULL;
 
-    /* Build new environment */
-    v->env = lenv_new();
+    /* Build the frame the arguments get bound in */
+    v->env = lenv_frame(formals);
 
-    /* Set Formals and Body */
+    /* Set Formals and the resolved Body */
     v->formals = formals;
-    v->body = body;
+    v->body = lval_resolve(body, formals);
+    lval_del(body);
 
     return v;
 }
 
 
 lval* lval_str(char* s) {
-    lval* v = malloc(sizeof(lval));
-
-    v->type = LVAL_STR;
-    v->str = malloc(strlen(s) + 1);
-    strcpy(v->str, s);
+    lval* v = lval_alloc(LVAL_STR);
+    lval_set_chars(v, s);
 
     return v;
 }
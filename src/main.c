@@ -14,12 +14,16 @@
 
 int main(int argc, char** argv) {
 
+    /* Nested evaluations measure the C stack they use from here */
+    lvm_native_room();
+
     Number  = mpc_new("number");
     Symbol  = mpc_new("symbol");
     String  = mpc_new("string");
     Comment = mpc_new("comment");
     Sexpr   = mpc_new("sexpr");
     Qexpr   = mpc_new("qexpr");
+    Map     = mpc_new("map");
     Expr    = mpc_new("expr");
     Lispy   = mpc_new("lispy");
 
@@ -31,16 +35,37 @@ int main(int argc, char** argv) {
             comment : /;[^\\r\\n]*/ ;                               \
             sexpr : '(' <expr>* ')' ;                               \
             qexpr : '{' <expr>* '}' ;                               \
+            map : \"#{\" <expr>* '}' ;                              \
             expr : <number> | <symbol> | <string>                   \
-                 | <comment> | <sexpr> | <qexpr>  ;                 \
+                 | <comment> | <sexpr> | <qexpr> | <map> ;          \
             lispy : /^/ <expr>* /$/ ;                               \
         ",
-		Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+		Number, Symbol, String, Comment, Sexpr, Qexpr, Map, Expr, Lispy);
 
     lenv* e = lenv_new();
     lenv_add_builtins(e);
 
-    if (argc == 1) {
+    /* Options come before the files */
+    int first = 1;
+    for (; first < argc && strncmp(argv[first], "--", 2) == 0; first++) {
+
+        /* Evaluate with the tree walker instead of the bytecode VM */
+        if (strcmp(argv[first], "--tree") == 0) { lvm_enabled = 0; continue; }
+
+        /* Read identical subtrees of a file or line into one node */
+        if (strcmp(argv[first], "--hash-cons") == 0) { lread_hash_cons = 1; continue; }
+
+        /* Limit on nested lambda calls */
+        if (strncmp(argv[first], "--max-depth=", 12) == 0) {
+            lvm_max_depth = atoi(argv[first] + 12);
+            if (lvm_max_depth > 0) { continue; }
+        }
+
+        fprintf(stderr, "Unknown option %s\n", argv[first]);
+        return 1;
+    }
+
+    if (first == argc) {
 
         puts("Lispy Version 0.0.3");
         puts("Press Ctrl+c to Exit\n");
@@ -53,9 +78,12 @@ int main(int argc, char** argv) {
             mpc_result_t r;
             if (mpc_parse("<stdin>", input, Lispy, &r)) {
 
+                LGC_REGION_BEGIN();
+
                 lval* x = lval_eval(e, lval_read(r.output));
                 lval_println(x);
                 lval_del(x);
+                LGC_REGION_END(e);
 
                 mpc_ast_delete(r.output);
             } else {
@@ -68,7 +96,7 @@ int main(int argc, char** argv) {
     }
     /* Supplied with list of files */
     /* loop over each file */
-    for (int i = 1; i < argc; i++) {
+    for (int i = first; i < argc; i++) {
 
         /* Argument list with a single argument, the filename */
         lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
@@ -77,15 +105,15 @@ int main(int argc, char** argv) {
         lval* x = builtin_load(e, args);
 
         /* If the result is an error be sure to print it */
-        if (x->type == LVAL_ERR) { lval_println(x); }
+        if (lval_type(x) == LVAL_ERR) { lval_println(x); }
         lval_del(x);
     }
 
     lenv_del(e);
 
-    mpc_cleanup(8, 
+    mpc_cleanup(9, 
             Number, Symbol, String, Comment, 
-            Sexpr, Qexpr, Expr, Lispy);
+            Sexpr, Qexpr, Map, Expr, Lispy);
 
     return 0;
 }
@@ -0,0 +1,858 @@
+/**********************************************************************
+ *
+ * Contains the hash maps and sets and their builtins
+ *
+ * A map is a hash array mapped trie: each node picks one of 32 slots
+ * with the next 5 bits of the key's hash, and keeps only the slots in
+ * use, found through a bitmap. Like every other value a map must not
+ * change once shared, so changing one copies just the nodes on the
+ * path to the key and shares the rest with the map it came from.
+ * Nodes only this map holds are changed in place. Keys whose 64 bit
+ * hashes are all equal end up together in a node searched in order.
+ *
+ * A set is a map from each of its elements to true, and only differs
+ * from one in how it prints and the builtins that take it.
+ *
+ * Hashes are structural and agree with lval_eq: values that compare
+ * equal always hash the same.
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "../include/repl.h"
+
+
+#define LNODE_BITS 5
+#define LNODE_FRAG(h, shift) ((uint32_t) ((h) >> (shift)) & 31)
+
+
+/* A key and its value, or a subtree in its place when "node" is set */
+typedef struct lentry {
+    uint64_t hash;
+    lval* key;
+    lval* val;
+    struct lnode* node;
+} lentry;
+
+
+/* Below a shift of 64 "bitmap" tells which fragments have a slot */
+typedef struct lnode {
+    int refs;
+    int count;
+    uint32_t bitmap;
+    lentry slots[];
+} lnode;
+
+
+
+/**
+ * Hashing
+ *
+ */
+
+/* Scramble the bits of a word (the splitmix64 finalizer) */
+static uint64_t lhash_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+
+/* Fold one more hash into a running hash, order matters */
+static uint64_t lhash_combine(uint64_t h, uint64_t x) {
+    return lhash_mix(h ^ (x + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
+
+
+/* FNV-1a over a block of bytes */
+static uint64_t lhash_bytes(const void* p, size_t n) {
+    const unsigned char* b = p;
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < n; i++) {
+        h ^= b[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+
+static void lnode_each(lnode*, void (*)(lentry*, void*), void*);
+
+
+/* Entries can be in any order, so a map hashes to the sum of them */
+static void lhash_entry(lentry* x, void* sum) {
+    *(uint64_t*) sum += lhash_combine(x->hash, lval_hash(x->val));
+}
+
+
+uint64_t lval_hash(lval* v) {
+    uint64_t h = lval_type(v);
+
+    switch (lval_type(v)) {
+        case LVAL_NUM:
+            if (lval_is_big(v)) {
+                h = lhash_combine(h, v->num < 0);
+                return lhash_combine(h, lhash_bytes(v->limbs, sizeof(uint32_t) * v->nlimbs));
+            }
+            return lhash_combine(h, lval_to_num(v));
+
+        /* By name rather than address, so maps print the same every run */
+        case LVAL_SYM: return lhash_combine(h, lhash_bytes(v->sym, strlen(v->sym)));
+        case LVAL_ERR: return lhash_combine(h, lhash_bytes(v->err, strlen(v->err)));
+        case LVAL_STR: return lhash_combine(h, lhash_bytes(v->str, strlen(v->str)));
+
+        case LVAL_VEC:
+            return lhash_combine(h, lhash_bytes(v->ints, sizeof(int64_t) * v->length));
+
+        case LVAL_FUN:
+            if (v->builtin) { return lhash_combine(h, (uintptr_t) v->builtin); }
+            h = lhash_combine(h, lval_hash(v->formals));
+            return lhash_combine(h, lval_hash(v->body));
+
+        /* Lists keep their hash until they change, 0 means not known */
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            if (v->hash) { return v->hash; }
+
+            for (int i = 0; i < v->count; i++) {
+                h = lhash_combine(h, lval_hash(v->cell[i]));
+            }
+
+            h = lhash_combine(h, v->count);
+            v->hash = h ? h : 1;
+            return v->hash;
+
+        case LVAL_MAP:
+        case LVAL_SET: {
+            uint64_t sum = 0;
+            lnode_each(v->root, lhash_entry, &sum);
+            return lhash_combine(h, sum);
+        }
+    }
+
+    return h;
+}
+
+
+
+/**
+ * Trie nodes
+ *
+ */
+
+static lnode* lnode_new(int count, uint32_t bitmap) {
+    lnode* n = malloc(sizeof(lnode) + sizeof(lentry) * count);
+    n->refs = 1;
+    n->count = count;
+    n->bitmap = bitmap;
+    return n;
+}
+
+
+/* Drop a reference to node "n", releasing the keys and values with it if "values" */
+static void lnode_del(lnode* n, int values) {
+    if (--n->refs > 0) { return; }
+
+    for (int i = 0; i < n->count; i++) {
+        lentry* x = &n->slots[i];
+
+        if (x->node) {
+            lnode_del(x->node, values);
+        } else if (values) {
+            lval_del(x->key);
+            lval_del(x->val);
+        }
+    }
+
+    free(n);
+}
+
+
+/* Node "n" if we hold the only reference to it, otherwise a copy of it */
+static lnode* lnode_own(lnode* n) {
+    if (n->refs == 1) { return n; }
+
+    lnode* x = lnode_new(n->count, n->bitmap);
+    memcpy(x->slots, n->slots, sizeof(lentry) * n->count);
+
+    for (int i = 0; i < x->count; i++) {
+        lentry* y = &x->slots[i];
+
+        if (y->node) {
+            y->node->refs++;
+        } else {
+            lval_copy(y->key);
+            lval_copy(y->val);
+        }
+    }
+
+    n->refs--;
+    return x;
+}
+
+
+/* Call "f" on every entry under node "n" */
+static void lnode_each(lnode* n, void (*f)(lentry*, void*), void* data) {
+    if (!n) { return; }
+
+    for (int i = 0; i < n->count; i++) {
+        if (n->slots[i].node) {
+            lnode_each(n->slots[i].node, f, data);
+        } else {
+            f(&n->slots[i], data);
+        }
+    }
+}
+
+
+/* The entry for key "k" with hash "h" under node "n", or NULL */
+static lentry* lnode_find(lnode* n, uint64_t h, lval* k) {
+    for (int shift = 0; n; shift += LNODE_BITS) {
+
+        /* Keys with the same hash sit side by side */
+        if (shift >= 64) {
+            for (int i = 0; i < n->count; i++) {
+                if (lval_eq(n->slots[i].key, k)) { return &n->slots[i]; }
+            }
+            return NULL;
+        }
+
+        uint32_t bit = 1u << LNODE_FRAG(h, shift);
+        if (!(n->bitmap & bit)) { return NULL; }
+
+        lentry* x = &n->slots[__builtin_popcount(n->bitmap & (bit - 1))];
+        if (!x->node) { return x->hash == h && lval_eq(x->key, k) ? x : NULL; }
+        n = x->node;
+    }
+
+    return NULL;
+}
+
+
+/* Owned node "n" with entry "x" inserted at slot "i" */
+static lnode* lnode_insert(lnode* n, int i, lentry x) {
+    n = realloc(n, sizeof(lnode) + sizeof(lentry) * (n->count + 1));
+    memmove(&n->slots[i+1], &n->slots[i], sizeof(lentry) * (n->count - i));
+    n->slots[i] = x;
+    n->count++;
+    return n;
+}
+
+
+/* A subtree at "shift" holding the entries "a" and "b", taking both */
+static lnode* lnode_pair(int shift, lentry a, lentry b) {
+    lnode* n;
+
+    if (shift >= 64) {
+        n = lnode_new(2, 0);
+        n->slots[0] = a;
+        n->slots[1] = b;
+        return n;
+    }
+
+    uint32_t fa = LNODE_FRAG(a.hash, shift);
+    uint32_t fb = LNODE_FRAG(b.hash, shift);
+
+    /* Both go the same way, so one level down holds them */
+    if (fa == fb) {
+        n = lnode_new(1, 1u << fa);
+        n->slots[0] = (lentry) { 0, NULL, NULL, lnode_pair(shift + LNODE_BITS, a, b) };
+        return n;
+    }
+
+    n = lnode_new(2, (1u << fa) | (1u << fb));
+    n->slots[fa < fb ? 0 : 1] = a;
+    n->slots[fa < fb ? 1 : 0] = b;
+    return n;
+}
+
+
+/* Node "n" with the key of entry "y" set to its value, taking both */
+static lnode* lnode_put(lnode* n, int shift, lentry y, int* added) {
+    n = lnode_own(n);
+
+    if (shift >= 64) {
+        for (int i = 0; i < n->count; i++) {
+            if (lval_eq(n->slots[i].key, y.key)) {
+                lval_del(y.key);
+                lval_del(n->slots[i].val);
+                n->slots[i].val = y.val;
+                return n;
+            }
+        }
+
+        *added = 1;
+        return lnode_insert(n, n->count, y);
+    }
+
+    uint32_t bit = 1u << LNODE_FRAG(y.hash, shift);
+    int i = __builtin_popcount(n->bitmap & (bit - 1));
+
+    if (!(n->bitmap & bit)) {
+        n->bitmap |= bit;
+        *added = 1;
+        return lnode_insert(n, i, y);
+    }
+
+    lentry* x = &n->slots[i];
+
+    if (x->node) {
+        x->node = lnode_put(x->node, shift + LNODE_BITS, y, added);
+        return n;
+    }
+
+    /* Keep the key already there, replace its value */
+    if (x->hash == y.hash && lval_eq(x->key, y.key)) {
+        lval_del(y.key);
+        lval_del(x->val);
+        x->val = y.val;
+        return n;
+    }
+
+    /* Two keys in one slot, push both down a level */
+    *added = 1;
+    lnode* c = lnode_pair(shift + LNODE_BITS, *x, y);
+    *x = (lentry) { 0, NULL, NULL, c };
+    return n;
+}
+
+
+/**
+ * Node "n" without key "k", which must be under it, or NULL if that
+ * leaves it empty. A subtree left with a single entry is replaced by
+ * that entry, so there is only ever one shape of trie for a set of keys.
+ */
+static lnode* lnode_remove(lnode* n, int shift, uint64_t h, lval* k) {
+    n = lnode_own(n);
+    int i = 0;
+
+    if (shift >= 64) {
+        while (!lval_eq(n->slots[i].key, k)) { i++; }
+
+    } else {
+        uint32_t bit = 1u << LNODE_FRAG(h, shift);
+        i = __builtin_popcount(n->bitmap & (bit - 1));
+        lentry* x = &n->slots[i];
+
+        if (x->node) {
+            lnode* c = lnode_remove(x->node, shift + LNODE_BITS, h, k);
+
+            if (c->count == 1 && !c->slots[0].node) {
+                *x = c->slots[0];
+                free(c);
+            } else {
+                x->node = c;
+            }
+            return n;
+        }
+
+        n->bitmap &= ~bit;
+    }
+
+    lval_del(n->slots[i].key);
+    lval_del(n->slots[i].val);
+
+    memmove(&n->slots[i], &n->slots[i+1], sizeof(lentry) * (n->count - i - 1));
+    n->count--;
+
+    if (n->count == 0) {
+        free(n);
+        return NULL;
+    }
+
+    return n;
+}
+
+
+
+/**
+ * Map values
+ *
+ */
+
+lval* lval_map(void) {
+    lval* v = lval_alloc(LVAL_MAP);
+    v->size = 0;
+    v->root = NULL;
+    return v;
+}
+
+
+/* Set "k" to "v" in map "m" we hold the only reference to, taking both */
+static void lval_map_put(lval* m, lval* k, lval* v) {
+    lentry y = { lval_hash(k), k, v, NULL };
+
+    if (!m->root) {
+        m->root = lnode_new(1, 1u << LNODE_FRAG(y.hash, 0));
+        m->root->slots[0] = y;
+        m->size = 1;
+    } else {
+        int added = 0;
+        m->root = lnode_put(m->root, 0, y, &added);
+        m->size += added;
+    }
+
+    LGC_WRITE(m);
+}
+
+
+/* Map with the keys and values of list "l" taken in turns, taking "l" */
+lval* lval_map_read(lval* l) {
+    if (l->count % 2) {
+        lval_del(l);
+        return lval_err("Map literal needs a value for every key.");
+    }
+
+    lval* m = lval_map();
+    for (int i = 0; i < l->count; i += 2) {
+        lval_map_put(m, lval_copy(l->cell[i]), lval_copy(l->cell[i+1]));
+    }
+
+    lval_del(l);
+    return m;
+}
+
+
+/* Another map or set sharing the whole trie of "v" */
+lval* lval_map_clone(lval* v) {
+    lval* x = lval_alloc(v->type);
+    x->size = v->size;
+    x->root = v->root;
+    if (x->root) { x->root->refs++; }
+    return x;
+}
+
+
+void lval_map_del(lval* v) {
+    if (v->root) { lnode_del(v->root, 1); }
+}
+
+
+/* The collector frees the keys and values itself, only drop the nodes */
+void lval_map_finalize(lval* v) {
+    if (v->root) { lnode_del(v->root, 0); }
+}
+
+
+/**
+ * Empty map "v" we hold the only reference to, letting go of its keys
+ * and values now. Under the collector nothing else would drop their
+ * reference counts, leaving them shared as far as copy on write knows.
+ */
+void lval_map_clear(lval* v) {
+    if (v->root) { lnode_del(v->root, 1); }
+    v->root = NULL;
+    v->size = 0;
+}
+
+
+static void lmap_trace_entry(lentry* x, void* mark) {
+    ((void (*)(lval*)) mark)(x->key);
+    ((void (*)(lval*)) mark)(x->val);
+}
+
+
+void lval_map_trace(lval* v, void (*mark)(lval*)) {
+    lnode_each(v->root, lmap_trace_entry, (void*) mark);
+}
+
+
+/* Counts the entries of one map that are in the other with equal values */
+typedef struct lmap_match {
+    lval* other;
+    int matched;
+} lmap_match;
+
+
+static void lmap_match_entry(lentry* x, void* data) {
+    lmap_match* m = data;
+    lentry* y = lnode_find(m->other->root, x->hash, x->key);
+    if (y && lval_eq(x->val, y->val)) { m->matched++; }
+}
+
+
+int lval_map_eq(lval* x, lval* y) {
+    if (x->size != y->size) { return 0; }
+    if (x->root == y->root) { return 1; }
+
+    lmap_match m = { y, 0 };
+    lnode_each(x->root, lmap_match_entry, &m);
+    return m.matched == x->size;
+}
+
+
+static void lmap_print_entry(lentry* x, void* first) {
+    if (!*(int*) first) { putchar(' '); }
+    lval_print(x->key);
+    putchar(' ');
+    lval_print(x->val);
+    *(int*) first = 0;
+}
+
+
+/* Print as a literal that reads back as the same map */
+void lval_map_print(lval* v) {
+    int first = 1;
+    printf("#{");
+    lnode_each(v->root, lmap_print_entry, &first);
+    putchar('}');
+}
+
+
+
+/**
+ * Builtins
+ *
+ */
+
+lval* builtin_map_get(lenv* e, lval* a) {
+    LASSERT_NUM("map-get", a, 2);
+    LASSERT_TYPE("map-get", a, 0, LVAL_MAP);
+
+    lval* k = a->cell[1];
+    lentry* x = lnode_find(a->cell[0]->root, lval_hash(k), k);
+    LASSERT(a, x, "Function 'map-get' passed a key not in the map.");
+
+    lval* v = lval_copy(x->val);
+    lval_del(a);
+    return v;
+}
+
+
+lval* builtin_map_has(lenv* e, lval* a) {
+    LASSERT_NUM("map-has", a, 2);
+    LASSERT_TYPE("map-has", a, 0, LVAL_MAP);
+
+    lval* k = a->cell[1];
+    int found = lnode_find(a->cell[0]->root, lval_hash(k), k) != NULL;
+
+    lval_del(a);
+    return lval_num(found);
+}
+
+
+lval* builtin_map_put(lenv* e, lval* a) {
+    LASSERT_NUM("map-put", a, 3);
+    LASSERT_TYPE("map-put", a, 0, LVAL_MAP);
+
+    lval* m = lval_unshare(lval_pop(a, 0));
+    lval_map_put(m, lval_copy(a->cell[0]), lval_copy(a->cell[1]));
+
+    lval_del(a);
+    return m;
+}
+
+
+lval* builtin_map_del(lenv* e, lval* a) {
+    LASSERT_NUM("map-del", a, 2);
+    LASSERT_TYPE("map-del", a, 0, LVAL_MAP);
+
+    lval* m = lval_pop(a, 0);
+    lval* k = a->cell[0];
+    uint64_t h = lval_hash(k);
+
+    /* Only copy the path to the key when there is one */
+    if (lnode_find(m->root, h, k)) {
+        m = lval_unshare(m);
+        m->root = lnode_remove(m->root, 0, h, k);
+        m->size--;
+    }
+
+    lval_del(a);
+    return m;
+}
+
+
+/* Keys or values of a map, in the same order */
+typedef struct lmap_list {
+    lval* list;
+    int vals;
+} lmap_list;
+
+
+static void lmap_list_entry(lentry* x, void* data) {
+    lmap_list* l = data;
+    l->list = lval_add(l->list, lval_copy(l->vals ? x->val : x->key));
+}
+
+
+static lval* lval_map_list(lval* a, char* name, int vals) {
+    LASSERT_NUM(name, a, 1);
+    LASSERT_TYPE(name, a, 0, LVAL_MAP);
+
+    lmap_list l = { lval_qexpr(), vals };
+    lval_reserve(l.list, a->cell[0]->size);
+    lnode_each(a->cell[0]->root, lmap_list_entry, &l);
+
+    lval_del(a);
+    return l.list;
+}
+
+
+lval* builtin_map_keys(lenv* e, lval* a) { return lval_map_list(a, "map-keys", 0); }
+lval* builtin_map_vals(lenv* e, lval* a) { return lval_map_list(a, "map-vals", 1); }
+
+
+lval* builtin_map_size(lenv* e, lval* a) {
+    LASSERT_NUM("map-size", a, 1);
+    LASSERT_TYPE("map-size", a, 0, LVAL_MAP);
+
+    lval* x = lval_num(a->cell[0]->size);
+    lval_del(a);
+    return x;
+}
+
+
+
+/**
+ * Sets
+ *
+ */
+
+typedef enum { LSET_UNION, LSET_INTER, LSET_DIFF } lset_op;
+
+
+lval* lval_set(void) {
+    lval* v = lval_map();
+    v->type = LVAL_SET;
+    return v;
+}
+
+
+int lval_set_has(lval* s, lval* x) {
+    return lnode_find(s->root, lval_hash(x), x) != NULL;
+}
+
+
+/* Add "x" to set "s" we hold the only reference to, taking "x" */
+static void lval_set_add(lval* s, lval* x) {
+    lval_map_put(s, x, lval_num(1));
+}
+
+
+/**
+ * The element of set "s" equal to "x" if there is one, otherwise "x"
+ * itself after adding it to "s" we hold the only reference to. Takes "x".
+ */
+lval* lval_set_intern(lval* s, lval* x) {
+    lentry* y = lnode_find(s->root, lval_hash(x), x);
+
+    if (y) {
+        lval_del(x);
+        return lval_copy(y->key);
+    }
+
+    lval_set_add(s, lval_copy(x));
+    return x;
+}
+
+
+/* Remove "x" from set "s" we hold the only reference to, if it is there */
+static void lval_set_remove(lval* s, lval* x) {
+    uint64_t h = lval_hash(x);
+
+    if (lnode_find(s->root, h, x)) {
+        s->root = lnode_remove(s->root, 0, h, x);
+        s->size--;
+        LGC_WRITE(s);
+    }
+}
+
+
+static void lset_print_entry(lentry* x, void* first) {
+    if (!*(int*) first) { putchar(' '); }
+    lval_print(x->key);
+    *(int*) first = 0;
+}
+
+
+void lval_set_print(lval* v) {
+    int first = 1;
+    printf("#[");
+    lnode_each(v->root, lset_print_entry, &first);
+    putchar(']');
+}
+
+
+/* Elements of one set checked against another, building a new set */
+typedef struct lset_filter {
+    lval* other;
+    lval* result;
+    int keep;
+} lset_filter;
+
+
+static void lset_filter_entry(lentry* x, void* data) {
+    lset_filter* f = data;
+
+    if ((lnode_find(f->other->root, x->hash, x->key) != NULL) == f->keep) {
+        lval_set_add(f->result, lval_copy(x->key));
+    }
+}
+
+
+/* Elements of "x" that are in "y" if "keep", otherwise those that are not */
+static lval* lval_set_filter(lval* x, lval* y, int keep) {
+    lset_filter f = { y, lval_set(), keep };
+    lnode_each(x->root, lset_filter_entry, &f);
+    return f.result;
+}
+
+
+/* Adds every element it is called on to a set */
+static void lset_add_entry(lentry* x, void* s) {
+    lval_set_add(s, lval_copy(x->key));
+}
+
+
+static void lset_remove_entry(lentry* x, void* s) {
+    lval_set_remove(s, x->key);
+}
+
+
+/**
+ * Set operations, taking both sets. Each one walks the smaller set
+ * and looks its elements up in the larger, which is a copy away from
+ * the result when the answer is built from the larger one.
+ */
+static lval* lval_set_op(lset_op op, lval* x, lval* y) {
+    lval* r;
+
+    switch (op) {
+        case LSET_UNION:
+            if (y->size > x->size) { r = x; x = y; y = r; }
+            r = lval_unshare(x);
+            lnode_each(y->root, lset_add_entry, r);
+            lval_del(y);
+            return r;
+
+        case LSET_INTER:
+            r = x->size <= y->size
+                ? lval_set_filter(x, y, 1)
+                : lval_set_filter(y, x, 1);
+            break;
+
+        case LSET_DIFF:
+            if (y->size < x->size) {
+                r = lval_unshare(x);
+                lnode_each(y->root, lset_remove_entry, r);
+                lval_del(y);
+                return r;
+            }
+            r = lval_set_filter(x, y, 0);
+            break;
+
+        default:
+            lval_del(x);
+            lval_del(y);
+            return lval_err("Unknown set operation %i.", op);
+    }
+
+    lval_del(x);
+    lval_del(y);
+    return r;
+}
+
+
+lval* builtin_set(lenv* e, lval* a) {
+    LASSERT_NUM("set", a, 1);
+    LASSERT_TYPE("set", a, 0, LVAL_QEXPR);
+
+    lval* l = a->cell[0];
+    lval* s = lval_set();
+
+    for (int i = 0; i < l->count; i++) { lval_set_add(s, lval_copy(l->cell[i])); }
+
+    lval_del(a);
+    return s;
+}
+
+
+lval* builtin_set_has(lenv* e, lval* a) {
+    LASSERT_NUM("set-has", a, 2);
+    LASSERT_TYPE("set-has", a, 0, LVAL_SET);
+
+    int found = lval_set_has(a->cell[0], a->cell[1]);
+    lval_del(a);
+    return lval_num(found);
+}
+
+
+lval* builtin_set_add(lenv* e, lval* a) {
+    LASSERT_NUM("set-add", a, 2);
+    LASSERT_TYPE("set-add", a, 0, LVAL_SET);
+
+    lval* s = lval_unshare(lval_pop(a, 0));
+    lval_set_add(s, lval_copy(a->cell[0]));
+
+    lval_del(a);
+    return s;
+}
+
+
+lval* builtin_set_del(lenv* e, lval* a) {
+    LASSERT_NUM("set-del", a, 2);
+    LASSERT_TYPE("set-del", a, 0, LVAL_SET);
+
+    lval* s = lval_pop(a, 0);
+    if (lval_set_has(s, a->cell[0])) {
+        s = lval_unshare(s);
+        lval_set_remove(s, a->cell[0]);
+    }
+
+    lval_del(a);
+    return s;
+}
+
+
+lval* builtin_set_list(lenv* e, lval* a) {
+    LASSERT_NUM("set-list", a, 1);
+    LASSERT_TYPE("set-list", a, 0, LVAL_SET);
+
+    lmap_list l = { lval_qexpr(), 0 };
+    lval_reserve(l.list, a->cell[0]->size);
+    lnode_each(a->cell[0]->root, lmap_list_entry, &l);
+
+    lval_del(a);
+    return l.list;
+}
+
+
+lval* builtin_set_size(lenv* e, lval* a) {
+    LASSERT_NUM("set-size", a, 1);
+    LASSERT_TYPE("set-size", a, 0, LVAL_SET);
+
+    lval* x = lval_num(a->cell[0]->size);
+    lval_del(a);
+    return x;
+}
+
+
+/* Fold a set operation over all the arguments, left to right */
+static lval* builtin_set_op(lenv* e, lval* a, lset_op op, char* name) {
+    LASSERT(a, a->count > 0,
+            "Function '%s' passed incorrect number of arguments."
+            "Got %i, Expected at least 1.",
+            name, a->count);
+
+    for (int i = 0; i < a->count; i++) { LASSERT_TYPE(name, a, i, LVAL_SET); }
+
+    lval* x = lval_pop(a, 0);
+    while (a->count) { x = lval_set_op(op, x, lval_pop(a, 0)); }
+
+    lval_del(a);
+    return x;
+}
+
+
+lval* builtin_set_union(lenv* e, lval* a) { return builtin_set_op(e, a, LSET_UNION, "set-union"); }
+lval* builtin_set_inter(lenv* e, lval* a) { return builtin_set_op(e, a, LSET_INTER, "set-inter"); }
+lval* builtin_set_diff(lenv* e, lval* a) { return builtin_set_op(e, a, LSET_DIFF, "set-diff"); }
@@ -0,0 +1,106 @@
+/**********************************************************************
+ *
+ * Contains the slab allocator behind every lval node
+ * Nodes are carved out of big slabs and kept in one free list per
+ * type, so constructing or deleting an lval is just a pointer pop or
+ * push instead of a trip into malloc and free
+ *
+ * Build with -DLVAL_MALLOC (make POOL=0) to fall back to plain
+ * malloc and free, which keeps valgrind and asan useful
+ * Build with -DLISPY_GC (make GC=1) to use the collector instead
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "../include/repl.h"
+
+
+/* Size class of a node of the given type */
+size_t lval_size(int type) {
+    switch (type) {
+        /* Lists carry their first few cells with them */
+        case LVAL_SEXPR:
+        case LVAL_QEXPR: return sizeof(lval) + sizeof(lval*) * LVAL_INLINE_CELLS;
+    }
+
+    return sizeof(lval);
+}
+
+
+#if defined(LISPY_GC)
+
+
+/* Nodes come from the collector's nursery, see gc.c */
+
+
+#elif defined(LVAL_MALLOC)
+
+
+lval* lval_alloc(int type) {
+    lval* v = malloc(lval_size(type));
+    v->type = type;
+    v->refs = 1;
+    return v;
+}
+
+
+void lval_free(lval* v) { free(v); }
+
+
+#else
+
+
+/* Number of nodes carved out of each slab */
+#define LPOOL_SLAB_NODES 1024
+
+
+/* A free node is reused to hold the link to the next free one */
+typedef struct lpool_node { struct lpool_node* next; } lpool_node;
+
+
+/* One free list per lval type so nodes of the same type stay together */
+static lpool_node* lpool_free[LVAL_TYPES];
+
+
+/* Carve a fresh slab into nodes and push them on the type's free list */
+static void lpool_grow(int type) {
+    size_t size = lval_size(type);
+    char* slab = malloc(size * LPOOL_SLAB_NODES);
+
+    /* Push in reverse so nodes are handed out in address order */
+    for (int i = LPOOL_SLAB_NODES-1; i >= 0; i--) {
+        lpool_node* n = (lpool_node*) (slab + i * size);
+        n->next = lpool_free[type];
+        lpool_free[type] = n;
+    }
+}
+
+
+lval* lval_alloc(int type) {
+    if (!lpool_free[type]) { lpool_grow(type); }
+
+    /* Pop the first free node */
+    lpool_node* n = lpool_free[type];
+    lpool_free[type] = n->next;
+
+    lval* v = (lval*) n;
+    v->type = type;
+    v->refs = 1;
+    return v;
+}
+
+
+void lval_free(lval* v) {
+    /* Push the node back on the free list of its current type */
+    lpool_node* n = (lpool_node*) v;
+    int type = v->type;
+
+    n->next = lpool_free[type];
+    lpool_free[type] = n;
+}
+
+
+#endif
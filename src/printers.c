@@ -33,13 +33,23 @@ void lval_expr_print(lval* v, char open, char close) {
 
 
 void lval_print(lval* v) {
-    switch (v->type) {
-        case LVAL_NUM: printf("%li", v->num); break;
+    switch (lval_type(v)) {
+        case LVAL_NUM:
+            if (lval_is_big(v)) {
+                lval_big_print(v);
+            } else {
+                printf("%li", lval_to_num(v));
+            }
+            break;
+
         case LVAL_ERR: printf("Error: %s", v->err); break;
         case LVAL_SYM: printf("%s", v->sym); break;
         case LVAL_STR: lval_print_str(v); break;
         case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
         case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
+        case LVAL_VEC: lval_vec_print(v); break;
+        case LVAL_MAP: lval_map_print(v); break;
+        case LVAL_SET: lval_set_print(v); break;
         case LVAL_FUN: 
                          
             if (v->builtin) {
@@ -79,6 +89,10 @@ char* ltype_name(int t) {
         case LVAL_STR: return "String";
         case LVAL_SEXPR: return "S-Expression";
         case LVAL_QEXPR: return "Q-Expression";
+        case LVAL_VEC: return "Vector";
+        case LVAL_MAP: return "Map";
+        case LVAL_SET: return "Set";
+        case LVAL_CELLS: return "Cells";
         default: return "Unknown";
     }
 }
@@ -13,15 +13,56 @@
 #include "../include/repl.h"
 
 
+/* The grammar, built in main */
+mpc_parser_t* Number;
+mpc_parser_t* Symbol;
+mpc_parser_t* String;
+mpc_parser_t* Comment;
+mpc_parser_t* Sexpr;
+mpc_parser_t* Qexpr;
+mpc_parser_t* Map;
+mpc_parser_t* Expr;
+mpc_parser_t* Lispy;
+
+
+/* Share one node between identical subtrees of an input (--hash-cons) */
+int lread_hash_cons = 0;
+
+/* Subtrees of the input being read so far, while hash consing */
+static lval* lread_seen = NULL;
+
+
 lval* lval_read_num(mpc_ast_t* t) {
     errno = 0;
     long x = strtol(t->contents, NULL, 10);
-    return errno != ERANGE ? lval_num(x) : lval_err("invalid number");
+    return errno != ERANGE ? lval_num(x) : lval_big_read(t->contents);
 }
 
 
+static lval* lval_read_node(mpc_ast_t* t);
+
+
 lval* lval_read(mpc_ast_t* t) {
 
+    /* Values are never changed while shared, so equal subtrees can be one */
+    if (lread_hash_cons && !lread_seen) {
+        lread_seen = lval_set();
+        lval* x = lval_read(t);
+
+        /* Give back the table's references so what was read once is unshared */
+        lval_map_clear(lread_seen);
+        lval_del(lread_seen);
+        lread_seen = NULL;
+        return x;
+    }
+
+    lval* x = lval_read_node(t);
+    return lread_seen ? lval_set_intern(lread_seen, x) : x;
+}
+
+
+static lval* lval_read_node(mpc_ast_t* t) {
+
     /* If Symbol or Number return conversion to that type */
     if (strstr(t->tag, "number")) { return lval_read_num(t); }
     if (strstr(t->tag, "string")) { return lval_read_str(t); }
@@ -34,6 +75,9 @@ lval* lval_read(mpc_ast_t* t) {
     if (strstr(t->tag, "sexpr"))    { x = lval_sexpr(); }
     if (strstr(t->tag, "qexpr"))    { x = lval_qexpr(); }
 
+    /* Maps read their keys and values as a list first */
+    if (strstr(t->tag, "map"))      { x = lval_qexpr(); }
+
     /* Fill this list with any valid expression contained within */
     for (int i = 0; i < t->children_num; i++) {
 
@@ -42,6 +86,7 @@ lval* lval_read(mpc_ast_t* t) {
 
         if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
         if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
+        if (strcmp(t->children[i]->contents, "#{") == 0) { continue; }
 
         if (strcmp(t->children[i]->tag,  "regex") == 0) { continue; }
         if (strstr(t->children[i]->tag, "comment")) { continue; }
@@ -49,6 +94,7 @@ lval* lval_read(mpc_ast_t* t) {
         x = lval_add(x, lval_read(t->children[i]));
     }
 
+    if (strstr(t->tag, "map")) { return lval_map_read(x); }
     return x;
 }
 
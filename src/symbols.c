@@ -0,0 +1,73 @@
+/**********************************************************************
+ *
+ * Contains the global symbol table
+ * Every symbol name is interned once when it is read, so symbols
+ * hold a unique pointer to their name and two symbols are the same
+ * exactly when those pointers are equal
+ * The table is open addressed and doubles when it gets half full
+ * Each name also counts how many non global bindings it has
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "../include/repl.h"
+
+
+static char** lsym_table = NULL;
+static unsigned long lsym_cap = 0;
+static unsigned long lsym_count = 0;
+
+
+/* FNV-1a hash of a string */
+unsigned long lsym_hash(char* s) {
+    unsigned long h = 14695981039346656037UL;
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+
+/* Double the table and reinsert every name */
+static void lsym_grow(void) {
+    unsigned long cap = lsym_cap ? lsym_cap * 2 : 1024;
+    char** table = calloc(cap, sizeof(char*));
+
+    for (unsigned long i = 0; i < lsym_cap; i++) {
+        if (!lsym_table[i]) { continue; }
+
+        unsigned long j = lsym_hash(lsym_table[i]) & (cap-1);
+        while (table[j]) { j = (j+1) & (cap-1); }
+        table[j] = lsym_table[i];
+    }
+
+    free(lsym_table);
+    lsym_table = table;
+    lsym_cap = cap;
+}
+
+
+/* Get the unique copy of a symbol name, adding it if it is new */
+char* lsym_intern(char* s) {
+    if (2 * (lsym_count+1) > lsym_cap) { lsym_grow(); }
+
+    unsigned long i = lsym_hash(s) & (lsym_cap-1);
+    while (lsym_table[i]) {
+        if (strcmp(lsym_table[i], s) == 0) { return lsym_table[i]; }
+        i = (i+1) & (lsym_cap-1);
+    }
+
+    /* Not seen before so keep a copy for the rest of the program */
+    lsym* n = malloc(sizeof(lsym) + strlen(s) + 1);
+    n->locals = 0;
+    strcpy(n->name, s);
+
+    lsym_table[i] = n->name;
+    lsym_count++;
+
+    return lsym_table[i];
+}
@@ -0,0 +1,593 @@
+/**********************************************************************
+ *
+ * Contains the packed numeric vectors and their builtins
+ *
+ * A vector holds its elements as one contiguous array of 64 bit
+ * integers instead of a list of Number nodes, and wraps around on
+ * overflow like machine integers do. The elementwise operators and
+ * the reductions run through a table of kernels picked once at run
+ * time: AVX2 or SSE2 on x86 processors that have them, plain C loops
+ * everywhere else (or always, when built with -DLVEC_SCALAR).
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#include "../include/repl.h"
+
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(LVEC_SCALAR)
+#define LVEC_X86
+#include <immintrin.h>
+#endif
+
+
+/* Kernels over "n" elements, results may be stored over an operand */
+typedef struct lvec_kernels {
+    void (*add)(int64_t*, int64_t*, int64_t*, int);
+    void (*sub)(int64_t*, int64_t*, int64_t*, int);
+    void (*mul)(int64_t*, int64_t*, int64_t*, int);
+    int64_t (*sum)(int64_t*, int);
+    int64_t (*min)(int64_t*, int);
+    int64_t (*max)(int64_t*, int);
+    int64_t (*dot)(int64_t*, int64_t*, int);
+} lvec_kernels;
+
+
+
+/**
+ * Portable kernels, also used for the tails the wide ones leave over
+ * Arithmetic goes through unsigned integers so overflow wraps around
+ */
+static void lvec_add_c(int64_t* r, int64_t* x, int64_t* y, int n) {
+    for (int i = 0; i < n; i++) { r[i] = (int64_t) ((uint64_t) x[i] + (uint64_t) y[i]); }
+}
+
+
+static void lvec_sub_c(int64_t* r, int64_t* x, int64_t* y, int n) {
+    for (int i = 0; i < n; i++) { r[i] = (int64_t) ((uint64_t) x[i] - (uint64_t) y[i]); }
+}
+
+
+static void lvec_mul_c(int64_t* r, int64_t* x, int64_t* y, int n) {
+    for (int i = 0; i < n; i++) { r[i] = (int64_t) ((uint64_t) x[i] * (uint64_t) y[i]); }
+}
+
+
+static int64_t lvec_sum_c(int64_t* x, int n) {
+    uint64_t s = 0;
+    for (int i = 0; i < n; i++) { s += (uint64_t) x[i]; }
+    return (int64_t) s;
+}
+
+
+static int64_t lvec_min_c(int64_t* x, int n) {
+    int64_t m = x[0];
+    for (int i = 1; i < n; i++) { if (x[i] < m) { m = x[i]; } }
+    return m;
+}
+
+
+static int64_t lvec_max_c(int64_t* x, int n) {
+    int64_t m = x[0];
+    for (int i = 1; i < n; i++) { if (x[i] > m) { m = x[i]; } }
+    return m;
+}
+
+
+static int64_t lvec_dot_c(int64_t* x, int64_t* y, int n) {
+    uint64_t s = 0;
+    for (int i = 0; i < n; i++) { s += (uint64_t) x[i] * (uint64_t) y[i]; }
+    return (int64_t) s;
+}
+
+
+static lvec_kernels lvec_c = {
+    lvec_add_c, lvec_sub_c, lvec_mul_c,
+    lvec_sum_c, lvec_min_c, lvec_max_c, lvec_dot_c
+};
+
+
+
+#ifdef LVEC_X86
+
+
+/**
+ * SSE2 kernels, two elements at a time
+ * There is no 64 bit multiply or compare before AVX-512 and SSE4.2, so
+ * products are put together from 32 bit ones and min/max stay scalar
+ */
+#define LVEC_SSE2 __attribute__((target("sse2")))
+
+
+LVEC_SSE2 static inline __m128i lvec_mullo_sse2(__m128i a, __m128i b) {
+    __m128i lo = _mm_mul_epu32(a, b);
+    __m128i hi = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b),
+                               _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+}
+
+
+LVEC_SSE2 static void lvec_add_sse2(int64_t* r, int64_t* x, int64_t* y, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i a = _mm_loadu_si128((__m128i*) (x + i));
+        __m128i b = _mm_loadu_si128((__m128i*) (y + i));
+        _mm_storeu_si128((__m128i*) (r + i), _mm_add_epi64(a, b));
+    }
+    lvec_add_c(r + i, x + i, y + i, n - i);
+}
+
+
+LVEC_SSE2 static void lvec_sub_sse2(int64_t* r, int64_t* x, int64_t* y, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i a = _mm_loadu_si128((__m128i*) (x + i));
+        __m128i b = _mm_loadu_si128((__m128i*) (y + i));
+        _mm_storeu_si128((__m128i*) (r + i), _mm_sub_epi64(a, b));
+    }
+    lvec_sub_c(r + i, x + i, y + i, n - i);
+}
+
+
+LVEC_SSE2 static void lvec_mul_sse2(int64_t* r, int64_t* x, int64_t* y, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i a = _mm_loadu_si128((__m128i*) (x + i));
+        __m128i b = _mm_loadu_si128((__m128i*) (y + i));
+        _mm_storeu_si128((__m128i*) (r + i), lvec_mullo_sse2(a, b));
+    }
+    lvec_mul_c(r + i, x + i, y + i, n - i);
+}
+
+
+LVEC_SSE2 static int64_t lvec_sum_sse2(int64_t* x, int n) {
+    __m128i s = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        s = _mm_add_epi64(s, _mm_loadu_si128((__m128i*) (x + i)));
+    }
+
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*) lanes, s);
+    return (int64_t) ((uint64_t) lanes[0] + (uint64_t) lanes[1]
+                    + (uint64_t) lvec_sum_c(x + i, n - i));
+}
+
+
+LVEC_SSE2 static int64_t lvec_dot_sse2(int64_t* x, int64_t* y, int n) {
+    __m128i s = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i a = _mm_loadu_si128((__m128i*) (x + i));
+        __m128i b = _mm_loadu_si128((__m128i*) (y + i));
+        s = _mm_add_epi64(s, lvec_mullo_sse2(a, b));
+    }
+
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*) lanes, s);
+    return (int64_t) ((uint64_t) lanes[0] + (uint64_t) lanes[1]
+                    + (uint64_t) lvec_dot_c(x + i, y + i, n - i));
+}
+
+
+static lvec_kernels lvec_sse2 = {
+    lvec_add_sse2, lvec_sub_sse2, lvec_mul_sse2,
+    lvec_sum_sse2, lvec_min_c, lvec_max_c, lvec_dot_sse2
+};
+
+
+
+/* AVX2 kernels, four elements at a time */
+#define LVEC_AVX2 __attribute__((target("avx2")))
+
+
+LVEC_AVX2 static inline __m256i lvec_mullo_avx2(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i hi = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                  _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+}
+
+
+/* Fold the four lanes of "s" into one */
+LVEC_AVX2 static inline int64_t lvec_lanes_avx2(__m256i s) {
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, s);
+    return (int64_t) ((uint64_t) lanes[0] + (uint64_t) lanes[1]
+                    + (uint64_t) lanes[2] + (uint64_t) lanes[3]);
+}
+
+
+LVEC_AVX2 static void lvec_add_avx2(int64_t* r, int64_t* x, int64_t* y, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((__m256i*) (x + i));
+        __m256i b = _mm256_loadu_si256((__m256i*) (y + i));
+        _mm256_storeu_si256((__m256i*) (r + i), _mm256_add_epi64(a, b));
+    }
+    lvec_add_c(r + i, x + i, y + i, n - i);
+}
+
+
+LVEC_AVX2 static void lvec_sub_avx2(int64_t* r, int64_t* x, int64_t* y, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((__m256i*) (x + i));
+        __m256i b = _mm256_loadu_si256((__m256i*) (y + i));
+        _mm256_storeu_si256((__m256i*) (r + i), _mm256_sub_epi64(a, b));
+    }
+    lvec_sub_c(r + i, x + i, y + i, n - i);
+}
+
+
+LVEC_AVX2 static void lvec_mul_avx2(int64_t* r, int64_t* x, int64_t* y, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((__m256i*) (x + i));
+        __m256i b = _mm256_loadu_si256((__m256i*) (y + i));
+        _mm256_storeu_si256((__m256i*) (r + i), lvec_mullo_avx2(a, b));
+    }
+    lvec_mul_c(r + i, x + i, y + i, n - i);
+}
+
+
+LVEC_AVX2 static int64_t lvec_sum_avx2(int64_t* x, int n) {
+    __m256i s = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s = _mm256_add_epi64(s, _mm256_loadu_si256((__m256i*) (x + i)));
+    }
+    return (int64_t) ((uint64_t) lvec_lanes_avx2(s) + (uint64_t) lvec_sum_c(x + i, n - i));
+}
+
+
+LVEC_AVX2 static int64_t lvec_min_avx2(int64_t* x, int n) {
+    if (n < 4) { return lvec_min_c(x, n); }
+
+    __m256i m = _mm256_loadu_si256((__m256i*) x);
+    int i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((__m256i*) (x + i));
+        m = _mm256_blendv_epi8(m, a, _mm256_cmpgt_epi64(m, a));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, m);
+    int64_t r = lvec_min_c(lanes, 4);
+    if (i < n) {
+        int64_t t = lvec_min_c(x + i, n - i);
+        if (t < r) { r = t; }
+    }
+    return r;
+}
+
+
+LVEC_AVX2 static int64_t lvec_max_avx2(int64_t* x, int n) {
+    if (n < 4) { return lvec_max_c(x, n); }
+
+    __m256i m = _mm256_loadu_si256((__m256i*) x);
+    int i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((__m256i*) (x + i));
+        m = _mm256_blendv_epi8(m, a, _mm256_cmpgt_epi64(a, m));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, m);
+    int64_t r = lvec_max_c(lanes, 4);
+    if (i < n) {
+        int64_t t = lvec_max_c(x + i, n - i);
+        if (t > r) { r = t; }
+    }
+    return r;
+}
+
+
+LVEC_AVX2 static int64_t lvec_dot_avx2(int64_t* x, int64_t* y, int n) {
+    __m256i s = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((__m256i*) (x + i));
+        __m256i b = _mm256_loadu_si256((__m256i*) (y + i));
+        s = _mm256_add_epi64(s, lvec_mullo_avx2(a, b));
+    }
+    return (int64_t) ((uint64_t) lvec_lanes_avx2(s) + (uint64_t) lvec_dot_c(x + i, y + i, n - i));
+}
+
+
+static lvec_kernels lvec_avx2 = {
+    lvec_add_avx2, lvec_sub_avx2, lvec_mul_avx2,
+    lvec_sum_avx2, lvec_min_avx2, lvec_max_avx2, lvec_dot_avx2
+};
+
+
+#endif
+
+
+
+/* Best kernels for the processor we run on, picked on first use */
+static lvec_kernels* lvec_k = NULL;
+
+
+static lvec_kernels* lvec_kernels_get(void) {
+    if (lvec_k) { return lvec_k; }
+
+    lvec_k = &lvec_c;
+
+#ifdef LVEC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        lvec_k = &lvec_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        lvec_k = &lvec_sse2;
+    }
+#endif
+
+    return lvec_k;
+}
+
+
+
+/**
+ * Values
+ *
+ */
+
+/* Construct a Vector lval taking over "n" elements of "ints" */
+lval* lval_vec(int64_t* ints, int n) {
+    lval* v = lval_alloc(LVAL_VEC);
+    v->length = n;
+    v->ints = ints;
+    return v;
+}
+
+
+static int64_t* lvec_alloc(int n) {
+    return malloc(sizeof(int64_t) * (n ? n : 1));
+}
+
+
+/* Whether a Number fits in an element */
+static int lvec_fits(lval* x) {
+    return !lval_is_big(x);
+}
+
+
+/* Elements of a vector operand, numbers are spread over "*fill" */
+static int64_t* lvec_operand(lval* x, int64_t** fill, int n) {
+    if (lval_type(x) == LVAL_VEC) { return x->ints; }
+
+    if (!*fill) { *fill = lvec_alloc(n); }
+    for (int i = 0; i < n; i++) { (*fill)[i] = lval_to_num(x); }
+    return *fill;
+}
+
+
+/**
+ * Elementwise + - * / over the vectors and numbers in "a", which has
+ * at least one vector. Vectors must all have the same length and
+ * numbers stand for a vector filled with them.
+ */
+lval* lval_vec_op(int op, lval* a) {
+    char* name = lbop_names[op];
+    int n = -1;
+
+    for (int i = 0; i < a->count; i++) {
+        lval* x = a->cell[i];
+
+        if (lval_type(x) == LVAL_VEC) {
+            LASSERT(a, n < 0 || x->length == n,
+                    "Function '%s' passed vectors of different lengths. "
+                    "Got %i, Expected %i.", name, x->length, n);
+            n = x->length;
+        } else {
+            LASSERT(a, lvec_fits(x),
+                    "Function '%s' passed a number too large for a vector.", name);
+        }
+    }
+
+    lvec_kernels* k = lvec_kernels_get();
+    int64_t* r = lvec_alloc(n);
+    int64_t* fill = NULL;
+
+    memcpy(r, lvec_operand(a->cell[0], &fill, n), sizeof(int64_t) * n);
+
+    /* If no arguments and sub then perform unary negation */
+    if (op == LBOP_SUB && a->count == 1) {
+        int64_t* zero = calloc(n ? n : 1, sizeof(int64_t));
+        k->sub(r, zero, r, n);
+        free(zero);
+    }
+
+    for (int i = 1; i < a->count; i++) {
+        int64_t* y = lvec_operand(a->cell[i], &fill, n);
+
+        switch (op) {
+            case LBOP_ADD: k->add(r, r, y, n); break;
+            case LBOP_SUB: k->sub(r, r, y, n); break;
+            case LBOP_MUL: k->mul(r, r, y, n); break;
+
+            /* No vector unit divides integers, so this one stays a loop */
+            case LBOP_DIV:
+                for (int j = 0; j < n; j++) {
+                    if (y[j] == 0) {
+                        free(r); free(fill);
+                        lval_del(a);
+                        return lval_err("Division By Zero!");
+                    }
+                    r[j] = y[j] == -1 ? (int64_t) (0 - (uint64_t) r[j]) : r[j] / y[j];
+                }
+                break;
+        }
+    }
+
+    free(fill);
+    lval_del(a);
+    return lval_vec(r, n);
+}
+
+
+int lval_vec_eq(lval* x, lval* y) {
+    return x->length == y->length
+        && memcmp(x->ints, y->ints, sizeof(int64_t) * x->length) == 0;
+}
+
+
+void lval_vec_print(lval* v) {
+    putchar('[');
+    for (int i = 0; i < v->length; i++) {
+        printf("%lld", (long long) v->ints[i]);
+        if (i != v->length-1) { putchar(' '); }
+    }
+    putchar(']');
+}
+
+
+
+/**
+ * Builtins
+ *
+ */
+
+/* Vector of the numbers passed, Q-Expressions of numbers are spliced in */
+lval* builtin_vec(lenv* e, lval* a) {
+    int n = 0;
+
+    for (int i = 0; i < a->count; i++) {
+        lval* x = a->cell[i];
+
+        if (lval_type(x) == LVAL_QEXPR) {
+            for (int j = 0; j < x->count; j++) {
+                LASSERT(a, lval_type(x->cell[j]) == LVAL_NUM && lvec_fits(x->cell[j]),
+                        "Function 'vec' passed a list with a non number at %i.", j);
+            }
+            n += x->count;
+            continue;
+        }
+
+        LASSERT(a, lval_type(x) == LVAL_NUM,
+                "Function 'vec' passed incorrect type for argument %i."
+                "Got %s, Expected %s.",
+                i, ltype_name(lval_type(x)), ltype_name(LVAL_NUM));
+        LASSERT(a, lvec_fits(x),
+                "Function 'vec' passed a number too large for a vector.");
+        n++;
+    }
+
+    int64_t* ints = lvec_alloc(n);
+    int k = 0;
+
+    for (int i = 0; i < a->count; i++) {
+        lval* x = a->cell[i];
+
+        if (lval_type(x) == LVAL_QEXPR) {
+            for (int j = 0; j < x->count; j++) { ints[k++] = lval_to_num(x->cell[j]); }
+        } else {
+            ints[k++] = lval_to_num(x);
+        }
+    }
+
+    lval_del(a);
+    return lval_vec(ints, n);
+}
+
+
+lval* builtin_vec_len(lenv* e, lval* a) {
+    LASSERT_NUM("vec-len", a, 1);
+    LASSERT_TYPE("vec-len", a, 0, LVAL_VEC);
+
+    lval* x = lval_num(a->cell[0]->length);
+    lval_del(a);
+    return x;
+}
+
+
+lval* builtin_vec_get(lenv* e, lval* a) {
+    LASSERT_NUM("vec-get", a, 2);
+    LASSERT_TYPE("vec-get", a, 0, LVAL_VEC);
+    LASSERT_TYPE("vec-get", a, 1, LVAL_NUM);
+
+    lval* v = a->cell[0];
+    long i = lval_to_num(a->cell[1]);
+    LASSERT(a, i >= 0 && i < v->length,
+            "Function 'vec-get' passed index %li out of range.", i);
+
+    lval* x = lval_num(v->ints[i]);
+    lval_del(a);
+    return x;
+}
+
+
+/* Elements from "start" up to, but not including, "end" */
+lval* builtin_vec_slice(lenv* e, lval* a) {
+    LASSERT_NUM("vec-slice", a, 3);
+    LASSERT_TYPE("vec-slice", a, 0, LVAL_VEC);
+    LASSERT_TYPE("vec-slice", a, 1, LVAL_NUM);
+    LASSERT_TYPE("vec-slice", a, 2, LVAL_NUM);
+
+    lval* v = a->cell[0];
+    long start = lval_to_num(a->cell[1]);
+    long end = lval_to_num(a->cell[2]);
+    LASSERT(a, start >= 0 && start <= end && end <= v->length,
+            "Function 'vec-slice' passed range %li to %li out of range.",
+            start, end);
+
+    int64_t* ints = lvec_alloc(end - start);
+    memcpy(ints, v->ints + start, sizeof(int64_t) * (end - start));
+
+    lval_del(a);
+    return lval_vec(ints, end - start);
+}
+
+
+lval* builtin_vec_sum(lenv* e, lval* a) {
+    LASSERT_NUM("vec-sum", a, 1);
+    LASSERT_TYPE("vec-sum", a, 0, LVAL_VEC);
+
+    lval* x = lval_num(lvec_kernels_get()->sum(a->cell[0]->ints, a->cell[0]->length));
+    lval_del(a);
+    return x;
+}
+
+
+lval* builtin_vec_min(lenv* e, lval* a) {
+    LASSERT_NUM("vec-min", a, 1);
+    LASSERT_TYPE("vec-min", a, 0, LVAL_VEC);
+    LASSERT(a, a->cell[0]->length != 0, "Function 'vec-min' passed an empty vector.");
+
+    lval* x = lval_num(lvec_kernels_get()->min(a->cell[0]->ints, a->cell[0]->length));
+    lval_del(a);
+    return x;
+}
+
+
+lval* builtin_vec_max(lenv* e, lval* a) {
+    LASSERT_NUM("vec-max", a, 1);
+    LASSERT_TYPE("vec-max", a, 0, LVAL_VEC);
+    LASSERT(a, a->cell[0]->length != 0, "Function 'vec-max' passed an empty vector.");
+
+    lval* x = lval_num(lvec_kernels_get()->max(a->cell[0]->ints, a->cell[0]->length));
+    lval_del(a);
+    return x;
+}
+
+
+lval* builtin_vec_dot(lenv* e, lval* a) {
+    LASSERT_NUM("vec-dot", a, 2);
+    LASSERT_TYPE("vec-dot", a, 0, LVAL_VEC);
+    LASSERT_TYPE("vec-dot", a, 1, LVAL_VEC);
+
+    lval* x = a->cell[0];
+    lval* y = a->cell[1];
+    LASSERT(a, x->length == y->length,
+            "Function 'vec-dot' passed vectors of different lengths. "
+            "Got %i, Expected %i.", y->length, x->length);
+
+    lval* r = lval_num(lvec_kernels_get()->dot(x->ints, y->ints, x->length));
+    lval_del(a);
+    return r;
+}
+
@@ -0,0 +1,426 @@
+/**********************************************************************
+ *
+ * Contains the stack virtual machine running compiled code (compiler.c)
+ *
+ * Every running piece of code shares one value stack, which the
+ * collector scans as a root. Dispatch uses computed gotos where the
+ * compiler supports them and falls back to a plain switch elsewhere.
+ * Running "./lispy --tree" evaluates everything with the tree walker
+ * instead, to compare the two.
+ *
+ * Calls from compiled code to compiled lambdas do not recurse in C:
+ * the caller's place is saved on a heap allocated stack of returns
+ * and the loop carries on in the callee, so recursion is bounded by
+ * lvm_max_depth ("--max-depth=N" or the "max-depth" builtin) and by
+ * memory, not by the C stack.
+ *
+ * Author: Joao Pargana
+ *
+ *
+ **********************************************************************/
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "../include/repl.h"
+
+
+int lvm_enabled = 1;
+
+lval** lvm_stack = NULL;
+int lvm_sp = 0;
+static int lvm_cap = 0;
+
+int lvm_max_depth = 1000000;
+int lvm_depth = 0;
+
+
+/* Where a compiled caller resumes once its callee returns */
+typedef struct lvm_return {
+    lcode* code;
+    lword* pc;
+    lenv* env;
+    lenv* stop;
+    int base;
+} lvm_return;
+
+static lvm_return* lvm_returns = NULL;
+static int lvm_rp = 0;
+static int lvm_rcap = 0;
+
+
+/* Reference counting without a call for immediates */
+#define LVM_COPY(v)  (lval_is_fixnum(v) ? (v) : lval_copy(v))
+#define LVM_DEL(v)   if (!lval_is_fixnum(v)) { lval_del(v); }
+
+
+/* Make sure "n" more values fit on the stack */
+static void lvm_reserve(int n) {
+    if (lvm_sp + n <= lvm_cap) { return; }
+    while (lvm_sp + n > lvm_cap) { lvm_cap = lvm_cap ? lvm_cap * 2 : 256; }
+    lvm_stack = realloc(lvm_stack, sizeof(lval*) * lvm_cap);
+}
+
+
+/* Pop values off the stack down to "base" */
+static void lvm_drop(int base) {
+    while (lvm_sp > base) {
+        lvm_sp--;
+        LVM_DEL(lvm_stack[lvm_sp]);
+    }
+}
+
+
+/**
+ * Whether the C stack has room for one more nested evaluation
+ * Measured from the first call, which happens near the top of main
+ */
+int lvm_native_room(void) {
+    static char* top = NULL;
+    static ptrdiff_t limit = 0;
+    char here;
+
+    if (!top) {
+        top = &here;
+
+        /* Leave a good margin of the stack for the builtins themselves */
+        limit = 8 << 20;
+#ifndef _WIN32
+        struct rlimit r;
+        if (getrlimit(RLIMIT_STACK, &r) == 0 && r.rlim_cur != RLIM_INFINITY) {
+            limit = r.rlim_cur;
+        }
+#endif
+        limit = limit / 4 * 3;
+    }
+
+    ptrdiff_t used = top > &here ? top - &here : &here - top;
+    return used < limit;
+}
+
+
+/* Arithmetic and comparisons on two immediates, or NULL to call "f" */
+static lval* lvm_binary(lbuiltin f, lval* x, lval* y) {
+    if (!lval_is_fixnum(x) || !lval_is_fixnum(y)) { return NULL; }
+
+    long a = lval_to_num(x);
+    long b = lval_to_num(y);
+
+    /* Sums of two immediates cannot overflow a long */
+    if (f == builtin_add) { return lval_num(a + b); }
+    if (f == builtin_sub) { return lval_num(a - b); }
+
+    if (f == builtin_lt) { return lval_num(a < b); }
+    if (f == builtin_gt) { return lval_num(a > b); }
+    if (f == builtin_le) { return lval_num(a <= b); }
+    if (f == builtin_ge) { return lval_num(a >= b); }
+    if (f == builtin_eq) { return lval_num(a == b); }
+    if (f == builtin_ne) { return lval_num(a != b); }
+
+    return NULL;
+}
+
+
+/**
+ * A frame binding the "n"-1 arguments on top of the stack for the
+ * lambda below them, when it takes exactly that many and none of the
+ * values is an error. The body is compiled on the first call.
+ * Returns NULL when the call needs the general lvm_call
+ */
+static lenv* lvm_frame(int n) {
+    static char* amp = NULL;
+    if (!amp) { amp = lsym_intern("&"); }
+
+    int call = lvm_sp - n;
+    lval* f = lvm_stack[call];
+    if (lval_type(f) != LVAL_FUN || f->builtin) { return NULL; }
+
+    /* Partially applied lambdas already have some slots bound */
+    lval* formals = f->formals;
+    if (formals->count != n-1 || f->env->nslots != n-1) { return NULL; }
+
+    for (int i = 0; i < n-1; i++) {
+        if (formals->cell[i]->sym == amp) { return NULL; }
+        if (lval_type(lvm_stack[call+1+i]) == LVAL_ERR) { return NULL; }
+    }
+
+    if (!f->env->code) { f->env->code = lcode_compile_body(f->body); }
+
+    lenv* frame = lenv_copy(f->env);
+    for (int i = 0; i < n-1; i++) {
+        lenv_put(frame, formals->cell[i], lvm_stack[call+1+i]);
+    }
+
+    /* The arguments are in the frame, only the callee stays */
+    lvm_drop(call + 1);
+    return frame;
+}
+
+
+/**
+ * Everything lval_eval_sexpr does once the "n" values on top of the
+ * stack are evaluated, leaving the result in their place
+ * The function stays on the stack during the call to keep it alive
+ */
+static void lvm_call(lenv* e, int n) {
+    int base = lvm_sp - n;
+    lval* f = lvm_stack[base];
+    lval* x = NULL;
+
+    /* Error Checking */
+    for (int i = base; i < lvm_sp; i++) {
+        if (lval_type(lvm_stack[i]) == LVAL_ERR) { x = lvm_stack[i]; break; }
+    }
+
+    if (x) {
+        lval_copy(x);
+
+    } else if (lval_type(f) != LVAL_FUN) {
+        x = lval_err(
+            "S-Expression starts with incorrect type."
+            "Got %s, Expected %s.",
+            ltype_name(lval_type(f)), ltype_name(LVAL_FUN));
+
+    } else {
+        if (f->builtin && n == 3) {
+            x = lvm_binary(f->builtin, lvm_stack[base+1], lvm_stack[base+2]);
+        }
+
+        if (!x) {
+            /* Move the arguments into a list of their own */
+            lval* a = lval_sexpr();
+            lval_reserve(a, n-1);
+            a->count = n-1;
+            memcpy(a->cell, &lvm_stack[base+1], sizeof(lval*) * a->count);
+            lvm_sp = base + 1;
+
+            x = lval_call(e, f, a);
+        }
+    }
+
+    lvm_drop(base);
+    lvm_stack[lvm_sp++] = x;
+}
+
+
+#if defined(__GNUC__)
+#define LVM_THREADED
+#endif
+
+
+#ifdef LVM_THREADED
+#define LVM_CASE(op)    lop_##op
+#define LVM_NEXT()      goto *lvm_labels[(pc++)->op]
+#define LVM_DISPATCH()  LVM_NEXT();
+#else
+#define LVM_CASE(op)    case op
+#define LVM_NEXT()      break
+#define LVM_DISPATCH()  for (;;) switch ((pc++)->op)
+#endif
+
+
+/**
+ * Run code in "e" and return the value it leaves on the stack
+ *
+ * Frames from "e" up to "stop" belong to the code being run: the one
+ * it was called with, if any, and those of the tail calls it makes.
+ * The stack from "base" holds that code's values, starting with the
+ * lambda it belongs to once a call or tail call entered it, which
+ * keeps the lambda (and so its code) alive.
+ */
+lval* lvm_run(lenv* e, lcode* c, lenv* stop) {
+
+#ifdef LVM_THREADED
+    static void* lvm_labels[] = {
+        &&lop_LOP_CONST, &&lop_LOP_EMPTY, &&lop_LOP_LOAD, &&lop_LOP_CALL,
+        &&lop_LOP_TAIL, &&lop_LOP_IF, &&lop_LOP_JUMP, &&lop_LOP_RETURN
+    };
+#endif
+
+    if (!lvm_native_room()) {
+        lenv_leave(e, stop);
+        return lval_err("Maximum call depth exceeded!");
+    }
+
+    /* Returns below this one belong to whoever called us */
+    int rp = lvm_rp;
+    int base = lvm_sp;
+    lword* pc = c->ops;
+    lvm_reserve(c->depth + 1);
+
+    LVM_DISPATCH() {
+
+        LVM_CASE(LOP_CONST):
+            lvm_stack[lvm_sp++] = LVM_COPY(pc->val);
+            pc++;
+            LVM_NEXT();
+
+        LVM_CASE(LOP_EMPTY):
+            lvm_stack[lvm_sp++] = lval_sexpr();
+            LVM_NEXT();
+
+        LVM_CASE(LOP_LOAD): {
+            lval* k = pc[0].val;
+            int s = k->slot;
+
+            /* Resolved references to our own frame skip lenv_get */
+            if (s >= 0 && s < e->nslots && e->names[s] == k->sym && e->slots[s]) {
+                lvm_stack[lvm_sp++] = LVM_COPY(e->slots[s]);
+
+            /* So do globals that have not changed since the last load */
+            } else if (LSYM(k->sym)->locals == 0 && pc[2].stamp == lenv_stamp) {
+                lvm_stack[lvm_sp++] = LVM_COPY(pc[1].val);
+
+            } else {
+                lval* x = lenv_get(e, k);
+                lvm_stack[lvm_sp++] = x;
+
+                if (LSYM(k->sym)->locals == 0 && e->glob && lval_type(x) != LVAL_ERR) {
+                    pc[1].val = x;
+                    pc[2].stamp = lenv_stamp;
+                }
+            }
+
+            pc += 3;
+            LVM_NEXT();
+        }
+
+        LVM_CASE(LOP_CALL): {
+            int n = (pc++)->arg;
+            int call = lvm_sp - n;
+
+            LGC_SAFEPOINT(e);
+
+            lenv* frame = lvm_depth < lvm_max_depth ? lvm_frame(n) : NULL;
+            if (!frame) {
+                if (lvm_depth >= lvm_max_depth &&
+                        lval_type(lvm_stack[call]) == LVAL_FUN &&
+                        !lvm_stack[call]->builtin) {
+                    lvm_drop(call);
+                    lvm_stack[lvm_sp++] = lval_err("Maximum call depth exceeded!");
+                } else {
+                    lvm_call(e, n);
+                }
+                LVM_NEXT();
+            }
+
+            /* Save our place and carry on in the callee */
+            if (lvm_rp == lvm_rcap) {
+                lvm_rcap = lvm_rcap ? lvm_rcap * 2 : 256;
+                lvm_returns = realloc(lvm_returns, sizeof(lvm_return) * lvm_rcap);
+            }
+
+            lvm_return* r = &lvm_returns[lvm_rp++];
+            r->code = c;
+            r->pc = pc;
+            r->env = e;
+            r->stop = stop;
+            r->base = base;
+            lvm_depth++;
+
+            frame->par = e;
+            frame->glob = e->glob;
+
+            stop = e;
+            e = frame;
+            base = call;
+            c = lvm_stack[call]->env->code;
+            pc = c->ops;
+            lvm_reserve(c->depth + 1);
+            LVM_NEXT();
+        }
+
+        LVM_CASE(LOP_TAIL): {
+            int n = (pc++)->arg;
+            int call = lvm_sp - n;
+
+            LGC_SAFEPOINT(e);
+
+            /* Anything but a plain lambda is a normal call, returned next */
+            lenv* frame = lvm_frame(n);
+            if (!frame) {
+                lvm_call(e, n);
+                LVM_NEXT();
+            }
+
+            /* The callee takes the place of the lambda we were running */
+            lval* f = lvm_stack[call];
+            lvm_stack[call] = lvm_stack[base];
+            lvm_stack[base] = f;
+            lvm_drop(base + 1);
+
+            e = lenv_enter(frame, e, stop);
+            c = f->env->code;
+            pc = c->ops;
+            lvm_reserve(c->depth + 1);
+            LVM_NEXT();
+        }
+
+        LVM_CASE(LOP_IF): {
+            lval* f = lvm_stack[lvm_sp-2];
+            lval* cond = lvm_stack[lvm_sp-1];
+
+            /* Only the real builtin with a numeric condition is inlined */
+            if (lval_type(f) != LVAL_FUN || f->builtin != builtin_if ||
+                    lval_type(cond) != LVAL_NUM) {
+                pc = c->ops + pc[1].arg;
+                LVM_NEXT();
+            }
+
+            int taken = lval_to_num(cond) != 0;
+            LVM_DEL(cond);
+            lval_del(f);
+            lvm_sp -= 2;
+
+            pc = taken ? pc + 2 : c->ops + pc[0].arg;
+            LVM_NEXT();
+        }
+
+        LVM_CASE(LOP_JUMP):
+            pc = c->ops + pc->arg;
+            LVM_NEXT();
+
+        LVM_CASE(LOP_RETURN): {
+            lval* x = lvm_stack[--lvm_sp];
+
+            /* Drop the lambda we were running, if any, and its frames */
+            lvm_drop(base);
+            lenv_leave(e, stop);
+
+            if (lvm_rp == rp) { return x; }
+
+            /* Resume the caller with the result in place of the call */
+            lvm_return* r = &lvm_returns[--lvm_rp];
+            lvm_depth--;
+
+            c = r->code;
+            pc = r->pc;
+            e = r->env;
+            stop = r->stop;
+            base = r->base;
+
+            lvm_stack[lvm_sp++] = x;
+            LVM_NEXT();
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Evaluate an expression by compiling it, like lval_eval it takes "v" */
+lval* lvm_eval(lenv* e, lval* v) {
+    LGC_PUSH_ROOT(v);
+
+    lcode* c = lcode_compile(v);
+    lval* x = lvm_run(e, c, e);
+    lcode_del(c);
+
+    LGC_POP_ROOTS(1);
+    lval_del(v);
+    return x;
+}